@@ -5,16 +5,18 @@
 #include "vm.h"
 
 void chunk_init(Chunk* chunk) {
-    chunk->cap   = 0;
-    chunk->len   = 0;
-    chunk->code  = NULL;
-    chunk->lines = NULL;
+    chunk->cap      = 0;
+    chunk->len      = 0;
+    chunk->code     = NULL;
+    chunk->lines    = NULL;
+    chunk->rewrites = NULL;
     value_array_init(&chunk->constants);
 }
 
 void chunk_free(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->cap);
     FREE_ARRAY(int, chunk->lines, chunk->cap);
+    FREE_ARRAY(uint8_t, chunk->rewrites, chunk->cap);
     value_array_free(&chunk->constants);
     chunk_init(chunk);
 }
@@ -38,3 +40,71 @@ int chunk_constants_add(Chunk* chunk, Value value){
     vm_stack_pop();
     return chunk->constants.len - 1;
 }
+
+// Length of the instruction at offset, 0 for an unknown opcode.
+int chunk_instruction_length(Chunk* chunk, int offset) {
+    switch(chunk->code[offset]) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_STR:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_INDEX_GET:
+        case OP_INDEX_SET:
+            return 1;
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_POP:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_SET_UPVALUE_POP:
+        case OP_GET_PARENT_LOCAL:
+        case OP_SET_PARENT_LOCAL:
+        case OP_SET_PARENT_LOCAL_POP:
+        case OP_SET_PROPERTY:
+        case OP_SET_PROPERTY_POP:
+        case OP_GET_SUPER:
+        case OP_BUILD_LIST:
+        case OP_BUILD_MAP:
+        case OP_BUILD_STRING:
+        case OP_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_GET_PROPERTY:
+        case OP_GET_FIELD_CACHED:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            return 3;
+        case OP_GUARD_GLOBAL:
+            return 5;
+        case OP_CLOSURE: {
+            Obj_Function* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + 2 * function->upvalue_count;
+        }
+        default: return 0;
+    }
+}
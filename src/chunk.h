@@ -3,6 +3,8 @@
 #include "common.h"
 #include "value.h"
 
+#define QUICKEN_REWRITES_MAX 4 // Specializations of an instruction, after which it stays in its generic form.
+
 typedef enum Op_Code {
     OP_CONSTANT,
     OP_NIL,
@@ -13,16 +15,31 @@ typedef enum Op_Code {
     OP_GET_GLOBAL,
     OP_DEFINE_GLOBAL,
     OP_SET_LOCAL,
+    OP_SET_LOCAL_POP,
     OP_SET_GLOBAL,
+    OP_SET_GLOBAL_POP,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
+    OP_SET_UPVALUE_POP,
+    OP_GET_PARENT_LOCAL,
+    OP_SET_PARENT_LOCAL,
+    OP_SET_PARENT_LOCAL_POP,
     OP_GET_PROPERTY,
+    OP_GET_FIELD_CACHED,
     OP_SET_PROPERTY,
+    OP_SET_PROPERTY_POP,
     OP_GET_SUPER,
+    OP_BUILD_LIST,
+    OP_BUILD_MAP,
+    OP_BUILD_STRING,
+    OP_INDEX_GET,
+    OP_INDEX_SET,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
     OP_ADD,
+    OP_ADD_NUM,
+    OP_ADD_STR,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
@@ -31,7 +48,9 @@ typedef enum Op_Code {
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
     OP_LOOP,
+    OP_GUARD_GLOBAL,
     OP_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
@@ -48,6 +67,7 @@ typedef struct Chunk {
     int         cap;
     uint8_t*    code;
     int*        lines;
+    uint8_t*    rewrites; // Specializations by instruction offset, NULL until one is quickened.
     Value_Array constants;
 } Chunk;
 
@@ -55,6 +75,7 @@ void chunk_init(Chunk* chunk);
 void chunk_free(Chunk* chunk);
 void chunk_write(Chunk* chunk, uint8_t byte, int line);
 int chunk_constants_add(Chunk* chunk, Value value);
+int chunk_instruction_length(Chunk* chunk, int offset);
 
 #define INTERP_CHUNK_H
 #endif
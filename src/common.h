@@ -5,10 +5,17 @@
 #include <stdint.h>
 
 #define NAN_BOXING
+#define OPTIMIZE_PEEPHOLE
+#define OPTIMIZE_IR
+#define OPTIMIZE_QUICKEN
+#define OPTIMIZE_JIT
+#define OPTIMIZE_COMPRESSED_REFS
 
 #define DEBUG_PRINT_CODE
 #define DEBUG_STRESS_GC
 #define DEBUG_LOG_GC
+#define DEBUG_LOG_OPTIMIZER
+#define DEBUG_LOG_QUICKEN
 #define DEBUG_TRACE_EXECUTION
 
 #define UINT8_COUNT (UINT8_MAX + 1)
@@ -4,13 +4,19 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "ir.h"
 #include "memory.h"
+#include "number.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+#ifdef OPTIMIZE_PEEPHOLE
+#include "optimizer.h"
+#endif
+
 typedef struct Parser {
     Scanner_Token current;
     Scanner_Token previous;
@@ -40,6 +46,15 @@ typedef struct Parse_Rule {
     Precedence precedence;
 } Parse_Rule;
 
+typedef Ir_Node* (*Ir_Prefix_Fn)(bool can_assign);
+typedef Ir_Node* (*Ir_Infix_Fn)(Ir_Node* left, bool can_assign);
+
+// Precedences are shared with `rules`.
+typedef struct Ir_Parse_Rule {
+    Ir_Prefix_Fn prefix;
+    Ir_Infix_Fn  infix;
+} Ir_Parse_Rule;
+
 typedef struct Local {
     Scanner_Token name;
     int           depth;
@@ -66,6 +81,8 @@ typedef struct Compiler {
     int              local_count;
     Upvalue          upvalues[UINT8_COUNT];
     int              scope_depth;
+    int              expression_start; // Chunk offset where the left operand of the current infix rule begins.
+    bool             is_contained;     // Only called from the enclosing function's frame, reads its locals in place.
 } Compiler;
 
 typedef struct Class_Compiler {
@@ -86,6 +103,7 @@ static uint8_t _variable_parse(const char* error_msg);
 static void    _variable_declare(void);
 static void    _variable_define(uint8_t global_var_idx);
 static void    _variable_named(Scanner_Token name, bool can_assign);
+static int     _variable_resolve(Scanner_Token* name, uint8_t* get_op, uint8_t* set_op);
 static void    _variable_mark_initialized(void);
 static uint8_t _constant_identifier(Scanner_Token* name);
 static bool    _match(Scanner_Token_Type type);
@@ -98,6 +116,7 @@ static void _declaration_var(void);
 static void _declaration_fun(void);
 static void _declaration_class(void);
 static void _statement(void);
+static void _statement_discard(void);
 static void _statement_print(void);
 static void _statement_for(void);
 static void _statement_if(void);
@@ -109,8 +128,11 @@ static void _number(bool can_assign);
 static void _grouping(bool can_assign);
 static void _unary(bool can_assign);
 static void _binary(bool can_assign);
+static void _binary_emit(Scanner_Token_Type operator_type);
 static void _literal(bool can_assign);
+static Value _string_part_value(const char* chars, int length);
 static void _string(bool can_assign);
+static void _interpolation(bool can_assign);
 static void _variable(bool can_assign);
 static void _and(bool can_assign);
 static void _or(bool can_assign);
@@ -118,9 +140,17 @@ static void _block(void);
 static void _scope_begin(void);
 static void _scope_end(void);
 static void _function(Function_Type type);
+static void _closure_emit(Compiler* compiler, Obj_Function* function);
 static void _function_call(bool can_assign);
+static bool _fold_unary(Scanner_Token_Type operator_type, int operand_start);
+static bool _fold_binary(Scanner_Token_Type operator_type, int left_start, int right_start);
+static bool _literal_at(int start, int end, Value* value);
+static void _literal_discard(int offset);
 static void _method(void);
 static void _dot(bool can_assign);
+static void _list(bool can_assign);
+static void _index(bool can_assign);
+static void _map(bool can_assign);
 static void _this(bool can_assign);
 static void _super(bool can_assign);
 
@@ -131,6 +161,7 @@ static void          _compiler_emit_byte(uint8_t byte);
 static void          _compiler_emit_bytes(uint8_t byte1, uint8_t byte2);
 static void          _compiler_emit_return(void);
 static void          _compiler_emit_constant(Value value);
+static void          _compiler_emit_literal(Value value);
 static int           _compiler_emit_jump(uint8_t instruction);
 static void          _compiler_emit_loop(int loop_start);
 static Chunk*        _compiler_current_chunk(void);
@@ -146,17 +177,63 @@ static void _jump_patch(int offset);
 static void _parser_advance(void);
 static void _parser_consume(Scanner_Token_Type type, const char* msg);
 
+static void     _ir_compile(void);
+static Ir_Node* _ir_node(Ir_Kind kind);
+static Ir_Node* _ir_declaration(void);
+static Ir_Node* _ir_declaration_var(void);
+static Ir_Node* _ir_declaration_class(void);
+static Ir_Node* _ir_function(Function_Type type);
+static Ir_Node* _ir_block(void);
+static Ir_Node* _ir_statement(void);
+static Ir_Node* _ir_statement_for(void);
+static Ir_Node* _ir_statement_return(void);
+static Ir_Node* _ir_statement_expression(void);
+static Ir_Node* _ir_expression(void);
+static Ir_Node* _ir_parse_precedence(Precedence precedence);
+static Ir_Node* _ir_argument_list(int* arg_count);
+static Ir_Node* _ir_number(bool can_assign);
+static Ir_Node* _ir_string(bool can_assign);
+static Ir_Node* _ir_interpolation(bool can_assign);
+static Ir_Node* _ir_literal(bool can_assign);
+static Ir_Node* _ir_grouping(bool can_assign);
+static Ir_Node* _ir_unary(bool can_assign);
+static Ir_Node* _ir_variable(bool can_assign);
+static Ir_Node* _ir_this(bool can_assign);
+static Ir_Node* _ir_super(bool can_assign);
+static Ir_Node* _ir_binary(Ir_Node* left, bool can_assign);
+static Ir_Node* _ir_and(Ir_Node* left, bool can_assign);
+static Ir_Node* _ir_or(Ir_Node* left, bool can_assign);
+static Ir_Node* _ir_call(Ir_Node* left, bool can_assign);
+static Ir_Node* _ir_dot(Ir_Node* left, bool can_assign);
+static Ir_Node* _ir_list(bool can_assign);
+static Ir_Node* _ir_index(Ir_Node* left, bool can_assign);
+static Ir_Node* _ir_map(bool can_assign);
+
+static void    _lower_statements(Ir_Node* statements);
+static void    _lower_statement(Ir_Node* node);
+static void    _lower_expressions(Ir_Node* expressions);
+static void    _lower_expression(Ir_Node* node);
+static void    _lower_function(Ir_Node* node, Function_Type type);
+static void    _lower_class(Ir_Node* node);
+static uint8_t _lower_variable_declare(Scanner_Token name);
+static void    _lower_variable_get(Scanner_Token name);
+
 Parser parser;
 Compiler* current_compiler    = NULL;
 Class_Compiler* current_class = NULL;
 Chunk* compiling_chunk;
+Ir_Arena* current_arena             = NULL;
+Function_Type current_function_type = TYPE_SCRIPT; // Function being parsed by the IR front end.
 
 Parse_Rule rules[] = {
     [TOKEN_LEFT_PAREN]    = {_grouping, _function_call, PREC_CALL},
     [TOKEN_RIGHT_PAREN]   = {NULL,      NULL,           PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL,      NULL,           PREC_NONE},
+    [TOKEN_LEFT_BRACE]    = {_map,      NULL,           PREC_NONE},
     [TOKEN_RIGHT_BRACE]   = {NULL,      NULL,           PREC_NONE},
+    [TOKEN_LEFT_BRACKET]  = {_list,     _index,         PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL,      NULL,           PREC_NONE},
     [TOKEN_COMMA]         = {NULL,      NULL,           PREC_NONE},
+    [TOKEN_COLON]         = {NULL,      NULL,           PREC_NONE},
     [TOKEN_DOT]           = {NULL,      _dot,           PREC_CALL},
     [TOKEN_MINUS]         = {_unary,    _binary,        PREC_TERM},
     [TOKEN_PLUS]          = {NULL,      _binary,        PREC_TERM},
@@ -173,6 +250,7 @@ Parse_Rule rules[] = {
     [TOKEN_LESS_EQUAL]    = {NULL,      _binary,        PREC_COMPARISON},
     [TOKEN_IDENTIFIER]    = {_variable, NULL,           PREC_NONE},
     [TOKEN_STRING]        = {_string,   NULL,           PREC_NONE},
+    [TOKEN_INTERPOLATION] = {_interpolation, NULL,      PREC_NONE},
     [TOKEN_NUMBER]        = {_number,   NULL,           PREC_NONE},
     [TOKEN_AND]           = {NULL,      _and,           PREC_AND},
     [TOKEN_CLASS]         = {NULL,      NULL,           PREC_NONE},
@@ -194,7 +272,54 @@ Parse_Rule rules[] = {
     [TOKEN_EOF]           = {NULL,      NULL,           PREC_NONE},
 };
 
-Obj_Function* compiler_compile(const char* source) {
+Ir_Parse_Rule ir_rules[] = {
+    [TOKEN_LEFT_PAREN]    = {_ir_grouping, _ir_call},
+    [TOKEN_RIGHT_PAREN]   = {NULL,         NULL},
+    [TOKEN_LEFT_BRACE]    = {_ir_map,      NULL},
+    [TOKEN_RIGHT_BRACE]   = {NULL,         NULL},
+    [TOKEN_LEFT_BRACKET]  = {_ir_list,     _ir_index},
+    [TOKEN_RIGHT_BRACKET] = {NULL,         NULL},
+    [TOKEN_COMMA]         = {NULL,         NULL},
+    [TOKEN_COLON]         = {NULL,         NULL},
+    [TOKEN_DOT]           = {NULL,         _ir_dot},
+    [TOKEN_MINUS]         = {_ir_unary,    _ir_binary},
+    [TOKEN_PLUS]          = {NULL,         _ir_binary},
+    [TOKEN_SEMICOLON]     = {NULL,         NULL},
+    [TOKEN_SLASH]         = {NULL,         _ir_binary},
+    [TOKEN_STAR]          = {NULL,         _ir_binary},
+    [TOKEN_BANG]          = {_ir_unary,    NULL},
+    [TOKEN_BANG_EQUAL]    = {NULL,         _ir_binary},
+    [TOKEN_EQUAL]         = {NULL,         NULL},
+    [TOKEN_EQUAL_EQUAL]   = {NULL,         _ir_binary},
+    [TOKEN_GREATER]       = {NULL,         _ir_binary},
+    [TOKEN_GREATER_EQUAL] = {NULL,         _ir_binary},
+    [TOKEN_LESS]          = {NULL,         _ir_binary},
+    [TOKEN_LESS_EQUAL]    = {NULL,         _ir_binary},
+    [TOKEN_IDENTIFIER]    = {_ir_variable, NULL},
+    [TOKEN_STRING]        = {_ir_string,   NULL},
+    [TOKEN_INTERPOLATION] = {_ir_interpolation, NULL},
+    [TOKEN_NUMBER]        = {_ir_number,   NULL},
+    [TOKEN_AND]           = {NULL,         _ir_and},
+    [TOKEN_CLASS]         = {NULL,         NULL},
+    [TOKEN_ELSE]          = {NULL,         NULL},
+    [TOKEN_FALSE]         = {_ir_literal,  NULL},
+    [TOKEN_FOR]           = {NULL,         NULL},
+    [TOKEN_FUN]           = {NULL,         NULL},
+    [TOKEN_IF]            = {NULL,         NULL},
+    [TOKEN_NIL]           = {_ir_literal,  NULL},
+    [TOKEN_OR]            = {NULL,         _ir_or},
+    [TOKEN_PRINT]         = {NULL,         NULL},
+    [TOKEN_RETURN]        = {NULL,         NULL},
+    [TOKEN_SUPER]         = {_ir_super,    NULL},
+    [TOKEN_THIS]          = {_ir_this,     NULL},
+    [TOKEN_TRUE]          = {_ir_literal,  NULL},
+    [TOKEN_VAR]           = {NULL,         NULL},
+    [TOKEN_WHILE]         = {NULL,         NULL},
+    [TOKEN_ERROR]         = {NULL,         NULL},
+    [TOKEN_EOF]           = {NULL,         NULL},
+};
+
+Obj_Function* compiler_compile(const char* source, Compile_Mode mode) {
     scanner_init(source);
     Compiler compiler;
     _compiler_init(&compiler, TYPE_SCRIPT);
@@ -203,8 +328,12 @@ Obj_Function* compiler_compile(const char* source) {
     parser.panic_mode = false;
 
     _parser_advance();
-    while(!_match(TOKEN_EOF)) {
-        _declaration();
+    if (mode == COMPILE_IR) {
+        _ir_compile();
+    } else {
+        while(!_match(TOKEN_EOF)) {
+            _declaration();
+        }
     }
 
     Obj_Function* function = _compiler_end();
@@ -217,6 +346,8 @@ void mark_compiler_roots(void) {
         mark_object((Obj*) compiler->function);
         compiler = compiler->enclosing;
     }
+
+    if (current_arena != NULL) ir_arena_mark(current_arena);
 }
 
 static void _declaration(void) {
@@ -437,6 +568,13 @@ static void _statement(void) {
     }
 }
 
+// Compiles a statement that can never run, only to report its errors and keep the scopes balanced.
+static void _statement_discard(void) {
+    int start = _compiler_current_chunk()->len;
+    _statement();
+    _compiler_current_chunk()->len = start;
+}
+
 static void _statement_print(void) {
     _expression();
     _parser_consume(TOKEN_SEMICOLON, "Expect ';' after value.");
@@ -446,7 +584,7 @@ static void _statement_print(void) {
 static void _statement_for(void) {
     _scope_begin();
 
-    _parser_consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    _parser_consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
     if (_match(TOKEN_SEMICOLON)) {
         // No initializer.
     } else if (_match(TOKEN_VAR)) {
@@ -492,9 +630,24 @@ static void _statement_for(void) {
 
 static void _statement_if(void) {
     _parser_consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    int condition_start = _compiler_current_chunk()->len;
     _expression();
     _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    Value condition;
+    if (_literal_at(condition_start, _compiler_current_chunk()->len, &condition)) {
+        // The branch taken is known at compile time, the other one is only parsed.
+        _literal_discard(condition_start);
+        if (ir_literal_is_falsey(condition)) {
+            _statement_discard();
+            if (_match(TOKEN_ELSE)) _statement();
+        } else {
+            _statement();
+            if (_match(TOKEN_ELSE)) _statement_discard();
+        }
+        return;
+    }
+
     int then_jump = _compiler_emit_jump(OP_JUMP_IF_FALSE);
     _compiler_emit_byte(OP_POP);
 
@@ -532,6 +685,19 @@ static void _statement_while(void) {
     _expression();
     _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    Value condition;
+    if (_literal_at(loop_start, _compiler_current_chunk()->len, &condition)) {
+        // A constant condition needs neither the test nor the exit jump.
+        _literal_discard(loop_start);
+        if (ir_literal_is_falsey(condition)) {
+            _statement_discard();
+        } else {
+            _statement();
+            _compiler_emit_loop(loop_start);
+        }
+        return;
+    }
+
     int exit_jump = _compiler_emit_jump(OP_JUMP_IF_FALSE);
     _compiler_emit_byte(OP_POP);
 
@@ -561,12 +727,14 @@ static void _parse_precedence(Precedence precedence) {
         return;
     }
 
+    int  start      = _compiler_current_chunk()->len;
     bool can_assign = precedence <= PREC_ASSIGNMENT;
     prefix_rule(can_assign);
 
     while(precedence <= _parse_rule_get(parser.current.type)->precedence) {
         _parser_advance();
         Parse_Fn infix_rule = _parse_rule_get(parser.previous.type)->infix;
+        current_compiler->expression_start = start;
         infix_rule(can_assign);
     }
 
@@ -593,8 +761,9 @@ static Parse_Rule* _parse_rule_get(Scanner_Token_Type token_type) {
 
 static void _number(bool can_assign) {
     (void) can_assign;
-    double value = strtod(parser.previous.start, NULL);
-    _compiler_emit_constant(V_NUMBER(value));
+    double value;
+    number_parse(parser.previous.start, parser.previous.length, &value);
+    _compiler_emit_constant(number_value(value));
 }
 
 static void _grouping(bool can_assign) {
@@ -606,10 +775,13 @@ static void _grouping(bool can_assign) {
 static void _unary(bool can_assign) {
     (void) can_assign;
     Scanner_Token_Type operator_type = parser.previous.type;
+    int operand_start = _compiler_current_chunk()->len;
 
     // Compile the operand.
     _parse_precedence(PREC_UNARY);
 
+    if (_fold_unary(operator_type, operand_start)) return;
+
     // Emit the operator instruction.
     switch(operator_type) {
         case TOKEN_BANG: {
@@ -627,10 +799,17 @@ static void _unary(bool can_assign) {
 
 static void _binary(bool can_assign) {
     (void) can_assign;
+    int left_start  = current_compiler->expression_start;
+    int right_start = _compiler_current_chunk()->len;
     Scanner_Token_Type operator_type = parser.previous.type;
     Parse_Rule* rule = _parse_rule_get(operator_type);
     _parse_precedence((Precedence) (rule->precedence + 1));
 
+    if (_fold_binary(operator_type, left_start, right_start)) return;
+    _binary_emit(operator_type);
+}
+
+static void _binary_emit(Scanner_Token_Type operator_type) {
     switch (operator_type) {
         case TOKEN_BANG_EQUAL: {
             _compiler_emit_bytes(OP_EQUAL, OP_NOT);
@@ -676,6 +855,61 @@ static void _binary(bool can_assign) {
     }
 }
 
+static bool _fold_unary(Scanner_Token_Type operator_type, int operand_start) {
+    Value operand, result;
+    if (!_literal_at(operand_start, _compiler_current_chunk()->len, &operand)) return false;
+    if (!ir_fold_unary(operator_type, operand, &result)) return false;
+
+    _literal_discard(operand_start);
+    _compiler_emit_literal(result);
+    return true;
+}
+
+static bool _fold_binary(Scanner_Token_Type operator_type, int left_start, int right_start) {
+    Value a, b, result;
+    if (!_literal_at(left_start, right_start, &a)) return false;
+    if (!_literal_at(right_start, _compiler_current_chunk()->len, &b)) return false;
+
+    // Both operands are still referenced by the constant table while folding.
+    if (!ir_fold_binary(operator_type, a, b, &result)) return false;
+
+    _literal_discard(right_start);
+    _literal_discard(left_start);
+    _compiler_emit_literal(result);
+    return true;
+}
+
+// Returns true when the code in [start, end) is a single instruction loading a literal, and gives back that literal.
+static bool _literal_at(int start, int end, Value* value) {
+    Chunk* chunk = _compiler_current_chunk();
+
+    switch(end - start) {
+        case 1: {
+            switch(chunk->code[start]) {
+                case OP_NIL:   *value = V_NIL;         return true;
+                case OP_TRUE:  *value = V_BOOL(true);  return true;
+                case OP_FALSE: *value = V_BOOL(false); return true;
+                default: return false;
+            }
+        }
+        case 2: {
+            if (chunk->code[start] != OP_CONSTANT) return false;
+            *value = chunk->constants.values[chunk->code[start + 1]];
+            return true;
+        }
+        default: return false;
+    }
+}
+
+// Removes the literal instruction at `offset`, which must be the last one emitted.
+static void _literal_discard(int offset) {
+    Chunk* chunk = _compiler_current_chunk();
+    if (chunk->code[offset] == OP_CONSTANT && chunk->code[offset + 1] == chunk->constants.len - 1) {
+        chunk->constants.len -= 1;
+    }
+    chunk->len = offset;
+}
+
 static void _literal(bool can_assign) {
     (void) can_assign;
     switch(parser.previous.type) {
@@ -695,9 +929,52 @@ static void _literal(bool can_assign) {
     }
 }
 
+// A string literal or interpolation part, with each `\${` turned into `${`.
+static Value _string_part_value(const char* chars, int length) {
+    int escape = 0;
+    while (escape < length - 2 && memcmp(chars + escape, "\\${", 3) != 0) escape += 1;
+    if (escape >= length - 2) return string_value(chars, length);
+
+    char* unescaped = ALLOCATE(char, length);
+    int   count     = 0;
+    for (int i = 0; i < length; i += 1) {
+        if (chars[i] == '\\' && i < length - 2 && chars[i + 1] == '$' && chars[i + 2] == '{') continue;
+        unescaped[count] = chars[i];
+        count           += 1;
+    }
+
+    Value string = string_value(unescaped, count);
+    FREE_ARRAY(char, unescaped, length);
+    return string;
+}
+
 static void _string(bool can_assign) {
     (void) can_assign;
-    _compiler_emit_constant(V_OBJ(string_copy(parser.previous.start + 1, parser.previous.length - 2)));
+    _compiler_emit_constant(_string_part_value(parser.previous.start + 1, parser.previous.length - 2));
+}
+
+// `"a ${b} c"` pushes each non-empty string part and each expression, OP_BUILD_STRING joins them.
+static void _interpolation(bool can_assign) {
+    (void) can_assign;
+    int count = 0;
+    do {
+        // Without the opening quote or `}`, and the `${`.
+        if (parser.previous.length > 3) {
+            _compiler_emit_constant(_string_part_value(parser.previous.start + 1, parser.previous.length - 3));
+            count += 1;
+        }
+        _expression();
+        count += 1;
+    } while(_match(TOKEN_INTERPOLATION));
+
+    _parser_consume(TOKEN_STRING, "Expect end of string interpolation.");
+    if (parser.previous.length > 2) {
+        _compiler_emit_constant(_string_part_value(parser.previous.start + 1, parser.previous.length - 2));
+        count += 1;
+    }
+
+    if (count > UINT8_MAX) _error("Can't have more than 255 parts in a string interpolation.");
+    _compiler_emit_bytes(OP_BUILD_STRING, (uint8_t) count);
 }
 
 static void _variable(bool can_assign) {
@@ -706,19 +983,7 @@ static void _variable(bool can_assign) {
 
 static void _variable_named(Scanner_Token name, bool can_assign) {
     uint8_t get_op, set_op;
-
-    int arg = _local_resolve(current_compiler, &name);
-    if (arg != -1) {
-        get_op = OP_GET_LOCAL;
-        set_op = OP_SET_LOCAL;
-    } else if ((arg = _upvalue_resolve(current_compiler, &name)) != -1) {
-        get_op = OP_GET_UPVALUE;
-        set_op = OP_SET_UPVALUE;
-    } else {
-        arg = _constant_identifier(&name);
-        get_op = OP_GET_GLOBAL;
-        set_op = OP_SET_GLOBAL;
-    }
+    int arg = _variable_resolve(&name, &get_op, &set_op);
 
     if (can_assign && _match(TOKEN_EQUAL)) {
         _expression();
@@ -728,6 +993,27 @@ static void _variable_named(Scanner_Token name, bool can_assign) {
     }
 }
 
+static int _variable_resolve(Scanner_Token* name, uint8_t* get_op, uint8_t* set_op) {
+    int arg = _local_resolve(current_compiler, name);
+    if (arg != -1) {
+        *get_op = OP_GET_LOCAL;
+        *set_op = OP_SET_LOCAL;
+    } else if (current_compiler->is_contained && (arg = _local_resolve(current_compiler->enclosing, name)) != -1) {
+        // No upvalue is captured, the enclosing frame is always right below this one.
+        *get_op = OP_GET_PARENT_LOCAL;
+        *set_op = OP_SET_PARENT_LOCAL;
+    } else if ((arg = _upvalue_resolve(current_compiler, name)) != -1) {
+        *get_op = OP_GET_UPVALUE;
+        *set_op = OP_SET_UPVALUE;
+    } else {
+        arg     = _constant_identifier(name);
+        *get_op = OP_GET_GLOBAL;
+        *set_op = OP_SET_GLOBAL;
+    }
+
+    return arg;
+}
+
 static void _and(bool can_assign) {
     (void) can_assign;
     int end_jump = _compiler_emit_jump(OP_JUMP_IF_FALSE);
@@ -797,11 +1083,14 @@ static void _function(Function_Type type) {
     _block();
 
     Obj_Function* function = _compiler_end(); // No _scope_end call needed because of this call.
+    _closure_emit(&compiler, function);
+}
 
+static void _closure_emit(Compiler* compiler, Obj_Function* function) {
     _compiler_emit_bytes(OP_CLOSURE, _make_constant(V_OBJ(function)));
     for (int i = 0; i < function->upvalue_count; i += 1) {
-        _compiler_emit_byte(compiler.upvalues[i].is_local ? 1 : 0);
-        _compiler_emit_byte(compiler.upvalues[i].idx);
+        _compiler_emit_byte(compiler->upvalues[i].is_local ? 1 : 0);
+        _compiler_emit_byte(compiler->upvalues[i].idx);
     }
 }
 
@@ -850,9 +1139,58 @@ static void _dot(bool can_assign) {
         _compiler_emit_byte(arg_count);
     } else {
         _compiler_emit_bytes(OP_GET_PROPERTY, name_constant);
+        _compiler_emit_byte(0); // Field entry, filled in by the VM when quickened.
     }
 }
 
+static void _list(bool can_assign) {
+    (void) can_assign;
+    int count = 0;
+    if (!_check(TOKEN_RIGHT_BRACKET)) {
+        do {
+            _expression();
+            if (count == 255) {
+                _error("Can't have more than 255 elements in a list literal.");
+            }
+            count += 1;
+        } while(_match(TOKEN_COMMA));
+    }
+
+    _parser_consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list elements.");
+    _compiler_emit_bytes(OP_BUILD_LIST, (uint8_t) count);
+}
+
+static void _index(bool can_assign) {
+    _expression();
+    _parser_consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+    if (can_assign && _match(TOKEN_EQUAL)) {
+        _expression();
+        _compiler_emit_byte(OP_INDEX_SET);
+    } else {
+        _compiler_emit_byte(OP_INDEX_GET);
+    }
+}
+
+// In expression position `{` starts a map, a statement starting with it is a block.
+static void _map(bool can_assign) {
+    (void) can_assign;
+    int count = 0;
+    if (!_check(TOKEN_RIGHT_BRACE)) {
+        do {
+            _expression();
+            _parser_consume(TOKEN_COLON, "Expect ':' after map key.");
+            _expression();
+            if (count == 255) {
+                _error("Can't have more than 255 entries in a map literal.");
+            }
+            count += 1;
+        } while(_match(TOKEN_COMMA));
+    }
+
+    _parser_consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    _compiler_emit_bytes(OP_BUILD_MAP, (uint8_t) count);
+}
+
 static void _this(bool can_assign) {
     (void) can_assign;
 
@@ -890,14 +1228,877 @@ static void _super(bool can_assign) {
     }
 }
 
+// IR front end: the whole script is parsed into an Ir_Node tree, optimized by ir_optimize(), and then lowered
+// to bytecode with the same helpers as the single pass compiler. Errors that only depend on the syntax are
+// reported while parsing, the ones needing scopes (locals, upvalues, constants) while lowering.
+
+static void _ir_compile(void) {
+    Ir_Arena arena;
+    ir_arena_init(&arena);
+    current_arena         = &arena;
+    current_function_type = TYPE_SCRIPT;
+
+    Ir_Node*  statements = NULL;
+    Ir_Node** tail       = &statements;
+    while(!_match(TOKEN_EOF)) {
+        *tail = _ir_declaration();
+        tail  = &(*tail)->next;
+    }
+
+    if (!parser.had_error) {
+        Scanner_Token end = parser.previous;
+        statements        = ir_optimize(&arena, statements);
+        _lower_statements(statements);
+        parser.previous   = end;
+    }
+
+    current_arena = NULL;
+    ir_arena_free(&arena);
+}
+
+static Ir_Node* _ir_node(Ir_Kind kind) {
+    return ir_node_new(current_arena, kind, parser.previous);
+}
+
+static Ir_Node* _ir_declaration(void) {
+    Ir_Node* node;
+    if (_match(TOKEN_CLASS)) {
+        node = _ir_declaration_class();
+    } else if (_match(TOKEN_FUN)) {
+        _parser_consume(TOKEN_IDENTIFIER, "Expect function name.");
+        node = _ir_function(TYPE_FUNCTION);
+    } else if (_match(TOKEN_VAR)) {
+        node = _ir_declaration_var();
+    } else {
+        node = _ir_statement();
+    }
+    if(parser.panic_mode) _synchronize_on_panic();
+    return node;
+}
+
+static Ir_Node* _ir_declaration_var(void) {
+    _parser_consume(TOKEN_IDENTIFIER, "expect variable name.");
+    Ir_Node* node = _ir_node(IR_VAR);
+
+    if (_match(TOKEN_EQUAL)) {
+        node->a = _ir_expression();
+    }
+
+    _parser_consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    return node;
+}
+
+static Ir_Node* _ir_declaration_class(void) {
+    _parser_consume(TOKEN_IDENTIFIER, "Expect class name.");
+    Ir_Node* node = _ir_node(IR_CLASS);
+
+    Class_Compiler class_compiler;
+    class_compiler.has_super_class = false;
+    class_compiler.enclosing       = current_class;
+    current_class                  = &class_compiler;
+
+    if (_match(TOKEN_LESS)) {
+        _parser_consume(TOKEN_IDENTIFIER, "Expect superclass name.");
+        node->a = _ir_node(IR_VARIABLE);
+
+        if (_identifiers_equal(&node->token, &parser.previous)) {
+            _error("A class can't inherit from itself.");
+        }
+        class_compiler.has_super_class = true;
+    }
+
+    _parser_consume(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    Ir_Node** tail = &node->b;
+    while(!_check(TOKEN_RIGHT_BRACE) && !_check(TOKEN_EOF)) {
+        _parser_consume(TOKEN_IDENTIFIER, "Expect method name.");
+        Function_Type type = TYPE_METHOD;
+        if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0) {
+            type = TYPE_INITIALIZER;
+        }
+        *tail = _ir_function(type);
+        tail  = &(*tail)->next;
+    }
+    _parser_consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+
+    current_class = current_class->enclosing;
+    return node;
+}
+
+// The function name has already been consumed.
+static Ir_Node* _ir_function(Function_Type type) {
+    Ir_Node* node                 = _ir_node(IR_FUNCTION);
+    Function_Type enclosing_type  = current_function_type;
+    current_function_type         = type;
+
+    _parser_consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!_check(TOKEN_RIGHT_PAREN)) {
+        Ir_Node** tail = &node->a;
+        do {
+            node->count += 1;
+            if (node->count > 255) {
+                _error_at_current("Can't have more than 255 parameters");
+            }
+            _parser_consume(TOKEN_IDENTIFIER, "Expect parameter name");
+            *tail = _ir_node(IR_VARIABLE);
+            tail  = &(*tail)->next;
+        } while(_match(TOKEN_COMMA));
+    }
+    _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+
+    _parser_consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    node->b = _ir_block();
+
+    current_function_type = enclosing_type;
+    return node;
+}
+
+// Returns the statements of a block whose '{' has been consumed.
+static Ir_Node* _ir_block(void) {
+    Ir_Node*  statements = NULL;
+    Ir_Node** tail       = &statements;
+    while(!_check(TOKEN_RIGHT_BRACE) && !_check(TOKEN_EOF)) {
+        *tail = _ir_declaration();
+        tail  = &(*tail)->next;
+    }
+
+    _parser_consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+    return statements;
+}
+
+static Ir_Node* _ir_statement(void) {
+    if(_match(TOKEN_PRINT)) {
+        Ir_Node* node = _ir_node(IR_PRINT);
+        node->a       = _ir_expression();
+        _parser_consume(TOKEN_SEMICOLON, "Expect ';' after value.");
+        return node;
+    } else if(_match(TOKEN_FOR)) {
+        return _ir_statement_for();
+    } else if(_match(TOKEN_IF)) {
+        Ir_Node* node = _ir_node(IR_IF);
+        _parser_consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+        node->a = _ir_expression();
+        _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+        node->b = _ir_statement();
+        if (_match(TOKEN_ELSE)) node->c = _ir_statement();
+        return node;
+    } else if(_match(TOKEN_RETURN)) {
+        return _ir_statement_return();
+    } else if(_match(TOKEN_WHILE)) {
+        Ir_Node* node = _ir_node(IR_WHILE);
+        _parser_consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+        node->a = _ir_expression();
+        _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+        node->b = _ir_statement();
+        return node;
+    } else if(_match(TOKEN_LEFT_BRACE)) {
+        Ir_Node* node = _ir_node(IR_BLOCK);
+        node->a       = _ir_block();
+        return node;
+    } else {
+        return _ir_statement_expression();
+    }
+}
+
+// `for (init; condition; increment) body` is desugared to `{ init; while (condition) { body increment; } }`.
+static Ir_Node* _ir_statement_for(void) {
+    Ir_Node* block = _ir_node(IR_BLOCK);
+
+    _parser_consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    Ir_Node* initializer = NULL;
+    if (_match(TOKEN_SEMICOLON)) {
+        // No initializer.
+    } else if (_match(TOKEN_VAR)) {
+        initializer = _ir_declaration_var();
+    } else {
+        initializer = _ir_statement_expression();
+    }
+
+    Ir_Node* loop = _ir_node(IR_WHILE);
+    if (!_match(TOKEN_SEMICOLON)) {
+        loop->a = _ir_expression();
+        _parser_consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+    }
+
+    Ir_Node* increment = NULL;
+    if (!_match(TOKEN_RIGHT_PAREN)) {
+        increment    = _ir_node(IR_EXPRESSION);
+        increment->a = _ir_expression();
+        _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    }
+
+    loop->b = _ir_statement();
+    if (increment != NULL) {
+        Ir_Node* body    = _ir_node(IR_BLOCK);
+        body->a          = loop->b;
+        body->a->next    = increment;
+        loop->b          = body;
+    }
+
+    if (initializer != NULL) {
+        initializer->next = loop;
+        block->a          = initializer;
+    } else {
+        block->a = loop;
+    }
+    return block;
+}
+
+static Ir_Node* _ir_statement_return(void) {
+    Ir_Node* node = _ir_node(IR_RETURN);
+    if (current_function_type == TYPE_SCRIPT) {
+        _error("Can't return from top-level code.");
+    }
+
+    if(!_match(TOKEN_SEMICOLON)) {
+        if (current_function_type == TYPE_INITIALIZER) {
+            _error("Can't return a value from an initializer.");
+        }
+
+        node->a = _ir_expression();
+        _parser_consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+    }
+    return node;
+}
+
+static Ir_Node* _ir_statement_expression(void) {
+    Ir_Node* node = _ir_node(IR_EXPRESSION);
+    node->a       = _ir_expression();
+    _parser_consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+    return node;
+}
+
+static Ir_Node* _ir_expression(void) {
+    return _ir_parse_precedence(PREC_ASSIGNMENT);
+}
+
+// Returns NULL after a syntax error, the tree is then never optimized nor lowered.
+static Ir_Node* _ir_parse_precedence(Precedence precedence) {
+    _parser_advance();
+    Ir_Prefix_Fn prefix_rule = ir_rules[parser.previous.type].prefix;
+
+    if(prefix_rule == NULL) {
+        _error("Expect expression.");
+        return NULL;
+    }
+
+    bool can_assign = precedence <= PREC_ASSIGNMENT;
+    Ir_Node* node   = prefix_rule(can_assign);
+
+    while(precedence <= _parse_rule_get(parser.current.type)->precedence) {
+        _parser_advance();
+        Ir_Infix_Fn infix_rule = ir_rules[parser.previous.type].infix;
+        node = infix_rule(node, can_assign);
+    }
+
+    if (can_assign && _match(TOKEN_EQUAL)) {
+        _error("Invalid assignment target.");
+    }
+
+    return node;
+}
+
+static Ir_Node* _ir_argument_list(int* arg_count) {
+    Ir_Node*  arguments = NULL;
+    Ir_Node** tail      = &arguments;
+    if (!_check(TOKEN_RIGHT_PAREN)) {
+        do {
+            Ir_Node* argument = _ir_expression();
+            if (argument != NULL) {
+                *tail = argument;
+                tail  = &argument->next;
+            }
+            if (*arg_count == 255) {
+                _error("Can't have more than 255 arguments.");
+            }
+            *arg_count += 1;
+        } while(_match(TOKEN_COMMA));
+    }
+
+    _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return arguments;
+}
+
+static Ir_Node* _ir_number(bool can_assign) {
+    (void) can_assign;
+    double value;
+    number_parse(parser.previous.start, parser.previous.length, &value);
+    return ir_literal_new(current_arena, parser.previous, number_value(value));
+}
+
+static Ir_Node* _ir_string(bool can_assign) {
+    (void) can_assign;
+    Value string = _string_part_value(parser.previous.start + 1, parser.previous.length - 2);
+    return ir_literal_new(current_arena, parser.previous, string);
+}
+
+static Ir_Node* _ir_interpolation(bool can_assign) {
+    (void) can_assign;
+    Ir_Node*  node = _ir_node(IR_INTERPOLATION);
+    Ir_Node** tail = &node->a;
+    do {
+        // Without the opening quote or `}`, and the `${`.
+        if (parser.previous.length > 3) {
+            Value part  = _string_part_value(parser.previous.start + 1, parser.previous.length - 3);
+            *tail       = ir_literal_new(current_arena, parser.previous, part);
+            tail        = &(*tail)->next;
+            node->count += 1;
+        }
+
+        Ir_Node* expression = _ir_expression();
+        if (expression != NULL) {
+            *tail = expression;
+            tail  = &expression->next;
+        }
+        node->count += 1;
+    } while(_match(TOKEN_INTERPOLATION));
+
+    _parser_consume(TOKEN_STRING, "Expect end of string interpolation.");
+    if (parser.previous.length > 2) {
+        Value part   = _string_part_value(parser.previous.start + 1, parser.previous.length - 2);
+        *tail        = ir_literal_new(current_arena, parser.previous, part);
+        node->count += 1;
+    }
+
+    if (node->count > UINT8_MAX) _error("Can't have more than 255 parts in a string interpolation.");
+    return node;
+}
+
+static Ir_Node* _ir_literal(bool can_assign) {
+    (void) can_assign;
+    switch(parser.previous.type) {
+        case TOKEN_FALSE: return ir_literal_new(current_arena, parser.previous, V_BOOL(false));
+        case TOKEN_TRUE:  return ir_literal_new(current_arena, parser.previous, V_BOOL(true));
+        default:          return ir_literal_new(current_arena, parser.previous, V_NIL);
+    }
+}
+
+static Ir_Node* _ir_grouping(bool can_assign) {
+    (void) can_assign;
+    Ir_Node* node = _ir_expression();
+    _parser_consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    return node;
+}
+
+static Ir_Node* _ir_unary(bool can_assign) {
+    (void) can_assign;
+    Ir_Node* node = _ir_node(IR_UNARY);
+    node->a       = _ir_parse_precedence(PREC_UNARY);
+    return node;
+}
+
+static Ir_Node* _ir_variable(bool can_assign) {
+    Ir_Node* node = _ir_node(IR_VARIABLE);
+    if (can_assign && _match(TOKEN_EQUAL)) {
+        node->kind = IR_ASSIGN;
+        node->a    = _ir_expression();
+    }
+    return node;
+}
+
+static Ir_Node* _ir_this(bool can_assign) {
+    (void) can_assign;
+
+    if(current_class == NULL) {
+        _error("Can't use 'this' outside of a class.");
+    }
+
+    return _ir_node(IR_THIS);
+}
+
+static Ir_Node* _ir_super(bool can_assign) {
+    (void) can_assign;
+    Ir_Node* super_variable = _ir_node(IR_VARIABLE);
+
+    if (current_class == NULL) {
+        _error("Can't use 'super' outside of a class.");
+    } else if (!current_class->has_super_class) {
+        _error("Can't use 'super' in a class with no superclass.");
+    }
+
+    _parser_consume(TOKEN_DOT, "Expect '.' after 'super'.");
+    _parser_consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
+    Ir_Node* node = _ir_node(IR_SUPER_GET);
+    node->a       = super_variable;
+
+    if(_match(TOKEN_LEFT_PAREN)) {
+        node->kind = IR_SUPER_INVOKE;
+        node->b    = _ir_argument_list(&node->count);
+    }
+    return node;
+}
+
+static Ir_Node* _ir_binary(Ir_Node* left, bool can_assign) {
+    (void) can_assign;
+    Ir_Node* node = _ir_node(IR_BINARY);
+    node->a       = left;
+    node->b       = _ir_parse_precedence((Precedence) (_parse_rule_get(node->token.type)->precedence + 1));
+    return node;
+}
+
+static Ir_Node* _ir_and(Ir_Node* left, bool can_assign) {
+    (void) can_assign;
+    Ir_Node* node = _ir_node(IR_AND);
+    node->a       = left;
+    node->b       = _ir_parse_precedence(PREC_AND);
+    return node;
+}
+
+static Ir_Node* _ir_or(Ir_Node* left, bool can_assign) {
+    (void) can_assign;
+    Ir_Node* node = _ir_node(IR_OR);
+    node->a       = left;
+    node->b       = _ir_parse_precedence(PREC_OR);
+    return node;
+}
+
+static Ir_Node* _ir_call(Ir_Node* left, bool can_assign) {
+    (void) can_assign;
+    Ir_Node* node = _ir_node(IR_CALL);
+    node->a       = left;
+    node->b       = _ir_argument_list(&node->count);
+    return node;
+}
+
+static Ir_Node* _ir_dot(Ir_Node* left, bool can_assign) {
+    _parser_consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    Ir_Node* node = _ir_node(IR_GET_PROPERTY);
+    node->a       = left;
+
+    if (can_assign && _match(TOKEN_EQUAL)) {
+        node->kind = IR_SET_PROPERTY;
+        node->b    = _ir_expression();
+    } else if(_match(TOKEN_LEFT_PAREN)) {
+        node->kind = IR_INVOKE;
+        node->b    = _ir_argument_list(&node->count);
+    }
+    return node;
+}
+
+static Ir_Node* _ir_list(bool can_assign) {
+    (void) can_assign;
+    Ir_Node*  node = _ir_node(IR_LIST);
+    Ir_Node** tail = &node->a;
+    if (!_check(TOKEN_RIGHT_BRACKET)) {
+        do {
+            Ir_Node* element = _ir_expression();
+            if (element != NULL) {
+                *tail = element;
+                tail  = &element->next;
+            }
+            if (node->count == 255) {
+                _error("Can't have more than 255 elements in a list literal.");
+            }
+            node->count += 1;
+        } while(_match(TOKEN_COMMA));
+    }
+
+    _parser_consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list elements.");
+    return node;
+}
+
+static Ir_Node* _ir_index(Ir_Node* left, bool can_assign) {
+    Ir_Node* node = _ir_node(IR_INDEX_GET);
+    node->a       = left;
+    node->b       = _ir_expression();
+    _parser_consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (can_assign && _match(TOKEN_EQUAL)) {
+        node->kind = IR_INDEX_SET;
+        node->c    = _ir_expression();
+    }
+    return node;
+}
+
+static Ir_Node* _ir_map(bool can_assign) {
+    (void) can_assign;
+    Ir_Node*  node = _ir_node(IR_MAP);
+    Ir_Node** tail = &node->a;
+    if (!_check(TOKEN_RIGHT_BRACE)) {
+        do {
+            Ir_Node* key = _ir_expression();
+            _parser_consume(TOKEN_COLON, "Expect ':' after map key.");
+            Ir_Node* value = _ir_expression();
+            if (key != NULL && value != NULL) {
+                *tail     = key;
+                key->next = value;
+                tail      = &value->next;
+            }
+            if (node->count == 255) {
+                _error("Can't have more than 255 entries in a map literal.");
+            }
+            node->count += 1;
+        } while(_match(TOKEN_COMMA));
+    }
+
+    _parser_consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    return node;
+}
+
+static void _lower_statements(Ir_Node* statements) {
+    for (Ir_Node* node = statements; node != NULL; node = node->next) {
+        _lower_statement(node);
+        // Report at most one error per statement, as `_synchronize_on_panic` does per declaration.
+        parser.panic_mode = false;
+    }
+}
+
+// Each node sets `parser.previous` to its token, which gives emitted instructions their line and errors their location.
+static void _lower_statement(Ir_Node* node) {
+    parser.previous = node->token;
+
+    switch(node->kind) {
+        case IR_EXPRESSION: {
+            _lower_expression(node->a);
+            _compiler_emit_byte(OP_POP);
+            break;
+        }
+        case IR_PRINT: {
+            _lower_expression(node->a);
+            _compiler_emit_byte(OP_PRINT);
+            break;
+        }
+        case IR_VAR: {
+            uint8_t global_var_idx = _lower_variable_declare(node->token);
+            if (node->a != NULL) {
+                _lower_expression(node->a);
+            } else {
+                _compiler_emit_byte(OP_NIL);
+            }
+            _variable_define(global_var_idx);
+            break;
+        }
+        case IR_BLOCK: {
+            _scope_begin();
+            _lower_statements(node->a);
+            _scope_end();
+            break;
+        }
+        case IR_IF: {
+            _lower_expression(node->a);
+            int then_jump = _compiler_emit_jump(OP_JUMP_IF_FALSE);
+            _compiler_emit_byte(OP_POP);
+
+            if (node->b != NULL) _lower_statement(node->b);
+            int else_jump = _compiler_emit_jump(OP_JUMP);
+
+            _jump_patch(then_jump);
+            _compiler_emit_byte(OP_POP);
+
+            if (node->c != NULL) _lower_statement(node->c);
+            _jump_patch(else_jump);
+            break;
+        }
+        case IR_WHILE: {
+            int loop_start = _compiler_current_chunk()->len;
+            if (node->a == NULL) {
+                if (node->b != NULL) _lower_statement(node->b);
+                _compiler_emit_loop(loop_start);
+                break;
+            }
+
+            _lower_expression(node->a);
+            int exit_jump = _compiler_emit_jump(OP_JUMP_IF_FALSE);
+            _compiler_emit_byte(OP_POP);
+
+            if (node->b != NULL) _lower_statement(node->b);
+            _compiler_emit_loop(loop_start);
+
+            _jump_patch(exit_jump);
+            _compiler_emit_byte(OP_POP);
+            break;
+        }
+        case IR_RETURN: {
+            if (node->a == NULL) {
+                _compiler_emit_return();
+            } else {
+                _lower_expression(node->a);
+                _compiler_emit_byte(OP_RETURN);
+            }
+            break;
+        }
+        case IR_FUNCTION: {
+            uint8_t global = _lower_variable_declare(node->token);
+            _variable_mark_initialized();
+            _lower_function(node, TYPE_FUNCTION);
+            _variable_define(global);
+            break;
+        }
+        case IR_CLASS: {
+            _lower_class(node);
+            break;
+        }
+        case IR_DISCARD: {
+            // Like `_statement_discard`, only for its errors and to keep the scopes balanced.
+            int start = _compiler_current_chunk()->len;
+            _lower_statements(node->a);
+            _compiler_current_chunk()->len = start;
+
+            if (node->b != NULL) _lower_statement(node->b);
+            break;
+        }
+        default: break; // Unreachable.
+    }
+}
+
+static void _lower_expressions(Ir_Node* expressions) {
+    for (Ir_Node* node = expressions; node != NULL; node = node->next) {
+        _lower_expression(node);
+    }
+}
+
+static void _lower_expression(Ir_Node* node) {
+    parser.previous = node->token;
+
+    switch(node->kind) {
+        case IR_LITERAL: {
+            _compiler_emit_literal(node->value);
+            break;
+        }
+        case IR_UNARY: {
+            _lower_expression(node->a);
+            parser.previous = node->token;
+            _compiler_emit_byte(node->token.type == TOKEN_BANG ? OP_NOT : OP_NEGATE);
+            break;
+        }
+        case IR_BINARY: {
+            _lower_expression(node->a);
+            _lower_expression(node->b);
+            parser.previous = node->token;
+            _binary_emit(node->token.type);
+            break;
+        }
+        case IR_AND: {
+            _lower_expression(node->a);
+            int end_jump = _compiler_emit_jump(OP_JUMP_IF_FALSE);
+
+            _compiler_emit_byte(OP_POP);
+            _lower_expression(node->b);
+
+            _jump_patch(end_jump);
+            break;
+        }
+        case IR_OR: {
+            _lower_expression(node->a);
+            int else_jump = _compiler_emit_jump(OP_JUMP_IF_FALSE);
+            int end_jump  = _compiler_emit_jump(OP_JUMP);
+
+            _jump_patch(else_jump);
+            _compiler_emit_byte(OP_POP);
+
+            _lower_expression(node->b);
+            _jump_patch(end_jump);
+            break;
+        }
+        case IR_VARIABLE:
+        case IR_THIS: {
+            _lower_variable_get(node->token);
+            break;
+        }
+        case IR_ASSIGN: {
+            uint8_t get_op, set_op;
+            int arg = _variable_resolve(&node->token, &get_op, &set_op);
+            _lower_expression(node->a);
+            parser.previous = node->token;
+            _compiler_emit_bytes(set_op, (uint8_t) arg);
+            break;
+        }
+        case IR_CALL: {
+            _lower_expression(node->a);
+            _lower_expressions(node->b);
+            parser.previous = node->token;
+            _compiler_emit_bytes(OP_CALL, (uint8_t) node->count);
+            break;
+        }
+        case IR_GET_PROPERTY: {
+            _lower_expression(node->a);
+            parser.previous = node->token;
+            _compiler_emit_bytes(OP_GET_PROPERTY, _constant_identifier(&node->token));
+            _compiler_emit_byte(0);
+            break;
+        }
+        case IR_SET_PROPERTY: {
+            _lower_expression(node->a);
+            _lower_expression(node->b);
+            parser.previous = node->token;
+            _compiler_emit_bytes(OP_SET_PROPERTY, _constant_identifier(&node->token));
+            break;
+        }
+        case IR_INVOKE: {
+            _lower_expression(node->a);
+            _lower_expressions(node->b);
+            parser.previous = node->token;
+            _compiler_emit_bytes(OP_INVOKE, _constant_identifier(&node->token));
+            _compiler_emit_byte((uint8_t) node->count);
+            break;
+        }
+        case IR_LIST: {
+            _lower_expressions(node->a);
+            parser.previous = node->token;
+            _compiler_emit_bytes(OP_BUILD_LIST, (uint8_t) node->count);
+            break;
+        }
+        case IR_MAP: {
+            _lower_expressions(node->a);
+            parser.previous = node->token;
+            _compiler_emit_bytes(OP_BUILD_MAP, (uint8_t) node->count);
+            break;
+        }
+        case IR_INTERPOLATION: {
+            _lower_expressions(node->a);
+            parser.previous = node->token;
+            _compiler_emit_bytes(OP_BUILD_STRING, (uint8_t) node->count);
+            break;
+        }
+        case IR_INDEX_GET: {
+            _lower_expression(node->a);
+            _lower_expression(node->b);
+            parser.previous = node->token;
+            _compiler_emit_byte(OP_INDEX_GET);
+            break;
+        }
+        case IR_INDEX_SET: {
+            _lower_expression(node->a);
+            _lower_expression(node->b);
+            _lower_expression(node->c);
+            parser.previous = node->token;
+            _compiler_emit_byte(OP_INDEX_SET);
+            break;
+        }
+        case IR_SUPER_GET: {
+            _lower_variable_get(synthetic_token("this"));
+            _lower_variable_get(node->a->token);
+            _compiler_emit_bytes(OP_GET_SUPER, _constant_identifier(&node->token));
+            break;
+        }
+        case IR_SUPER_INVOKE: {
+            _lower_variable_get(synthetic_token("this"));
+            _lower_expressions(node->b);
+            parser.previous = node->token;
+            _lower_variable_get(node->a->token);
+            _compiler_emit_bytes(OP_SUPER_INVOKE, _constant_identifier(&node->token));
+            _compiler_emit_byte((uint8_t) node->count);
+            break;
+        }
+        case IR_INLINE: {
+            // The function may be lowered after this call, so the guard refers to an Obj_Function created up front.
+            Ir_Node* function = node->c;
+            if (IS_NIL(function->value)) {
+                Obj_Function* inlined = function_new();
+                ir_value_keep(current_arena, V_OBJ(inlined));
+                function->value       = V_OBJ(inlined);
+                inlined->name         = string_copy(function->token.start, function->token.length);
+            }
+
+            uint8_t name_constant     = _constant_identifier(&node->token);
+            uint8_t function_constant = _make_constant(function->value);
+            AS_STRING(_compiler_current_chunk()->constants.values[name_constant])->is_guarded = true;
+            _compiler_emit_bytes(OP_GUARD_GLOBAL, name_constant);
+            _compiler_emit_bytes(function_constant, 0xff);
+            _compiler_emit_byte(0xff);
+            int guard_jump = _compiler_current_chunk()->len - 2;
+
+            _lower_expression(node->a);
+            int end_jump = _compiler_emit_jump(OP_JUMP);
+
+            _jump_patch(guard_jump);
+            _lower_expression(node->b);
+            _jump_patch(end_jump);
+            break;
+        }
+        default: break; // Unreachable.
+    }
+}
+
+static void _lower_function(Ir_Node* node, Function_Type type) {
+    // `_compiler_init` names the function after `parser.previous`.
+    parser.previous = node->token;
+
+    Compiler compiler;
+    _compiler_init(&compiler, type);
+    compiler.is_contained = node->is_contained;
+    if (IS_FUNCTION(node->value)) {
+        compiler.function = AS_FUNCTION(node->value);
+    }
+    _scope_begin();
+
+    for (Ir_Node* parameter = node->a; parameter != NULL; parameter = parameter->next) {
+        current_compiler->function->arity += 1;
+        uint8_t constant_idx = _lower_variable_declare(parameter->token);
+        _variable_define(constant_idx);
+    }
+
+    _lower_statements(node->b);
+
+    Obj_Function* function = _compiler_end(); // No _scope_end call needed because of this call.
+    _closure_emit(&compiler, function);
+
+    // Guards lowered after this point check against this function.
+    if (IS_NIL(node->value)) {
+        node->value = V_OBJ(function);
+        ir_value_keep(current_arena, node->value);
+    }
+}
+
+static void _lower_class(Ir_Node* node) {
+    Scanner_Token class_name = node->token;
+    uint8_t name_constant    = _constant_identifier(&class_name);
+    _variable_declare();
+
+    _compiler_emit_bytes(OP_CLASS, name_constant);
+    _variable_define(name_constant);
+
+    if (node->a != NULL) {
+        _lower_expression(node->a);
+
+        _scope_begin();
+        _local_add(synthetic_token("super"));
+        _variable_define(0);
+
+        parser.previous = class_name;
+        _lower_variable_get(class_name);
+        _compiler_emit_byte(OP_INHERIT);
+    }
+
+    _lower_variable_get(class_name);
+    for (Ir_Node* method = node->b; method != NULL; method = method->next) {
+        uint8_t constant_idx = _constant_identifier(&method->token);
+        Function_Type type   = TYPE_METHOD;
+        if (method->token.length == 4 && memcmp(method->token.start, "init", 4) == 0) {
+            type = TYPE_INITIALIZER;
+        }
+        _lower_function(method, type);
+        _compiler_emit_bytes(OP_METHOD, constant_idx);
+    }
+
+    _compiler_emit_byte(OP_POP);
+    if (node->a != NULL) {
+        _scope_end();
+    }
+}
+
+static uint8_t _lower_variable_declare(Scanner_Token name) {
+    parser.previous = name;
+    _variable_declare();
+    if (current_compiler->scope_depth > 0) return 0;
+    return _constant_identifier(&name);
+}
+
+static void _lower_variable_get(Scanner_Token name) {
+    uint8_t get_op, set_op;
+    int arg = _variable_resolve(&name, &get_op, &set_op);
+    _compiler_emit_bytes(get_op, (uint8_t) arg);
+}
+
 static void _compiler_init(Compiler* compiler, Function_Type type) {
-    compiler->enclosing   = current_compiler;
-    compiler->function    = NULL;
-    compiler->type        = type;
-    compiler->local_count = 0;
-    compiler->scope_depth = 0;
-    compiler->function    = function_new();
-    current_compiler      = compiler;
+    compiler->enclosing        = current_compiler;
+    compiler->function         = NULL;
+    compiler->type             = type;
+    compiler->local_count      = 0;
+    compiler->scope_depth      = 0;
+    compiler->expression_start = 0;
+    compiler->is_contained     = false;
+    compiler->function         = function_new();
+    current_compiler           = compiler;
     if (type != TYPE_SCRIPT) {
         current_compiler->function->name = string_copy(parser.previous.start, parser.previous.length);
     }
@@ -917,6 +2118,12 @@ static Obj_Function* _compiler_end(void) {
     _compiler_emit_return();
     Obj_Function* function = current_compiler->function;
 
+    #ifdef OPTIMIZE_PEEPHOLE
+    if (!parser.had_error) {
+        chunk_optimize(_compiler_current_chunk(), function->name != NULL ? function->name->chars : "<script>");
+    }
+    #endif
+
     #ifdef DEBUG_PRINT_CODE
     if (!parser.had_error) {
         chunk_disassemble(_compiler_current_chunk(), function->name != NULL ? function->name->chars : "<script>");
@@ -950,6 +2157,16 @@ static void _compiler_emit_constant(Value value) {
     _compiler_emit_bytes(OP_CONSTANT, _make_constant(value));
 }
 
+static void _compiler_emit_literal(Value value) {
+    if (IS_NIL(value)) {
+        _compiler_emit_byte(OP_NIL);
+    } else if (IS_BOOL(value)) {
+        _compiler_emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        _compiler_emit_constant(value);
+    }
+}
+
 static int _compiler_emit_jump(uint8_t instruction) {
     _compiler_emit_byte(instruction);
     _compiler_emit_byte(0xff);
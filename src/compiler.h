@@ -1,9 +1,13 @@
 #ifndef INTERP_COMPILER_H
 
 #include "object.h"
-#include "vm.h"
 
-Obj_Function* compiler_compile(const char* source);
+typedef enum Compile_Mode {
+    COMPILE_SINGLE_PASS, // Bytecode is emitted while parsing, the fastest to compile.
+    COMPILE_IR,          // The whole script is parsed to an IR which is optimized before emitting bytecode.
+} Compile_Mode;
+
+Obj_Function* compiler_compile(const char* source, Compile_Mode mode);
 
 void mark_compiler_roots(void);
 
@@ -6,6 +6,8 @@
 
 static int _instruction_byte(const char* name, Chunk* chunk, int offset);
 static int _instruction_jump(const char* name, int sign, Chunk* chunk, int offset);
+static int _instruction_guard(const char* name, Chunk* chunk, int offset);
+static int _instruction_property(const char* name, Chunk* chunk, int offset);
 
 static int instruction_simple(const char* name, int offset) {
     printf("%s\n", name);
@@ -33,6 +35,28 @@ static int _instruction_jump(const char* name, int sign, Chunk* chunk, int offse
     return offset + 3;
 }
 
+static int _instruction_guard(const char* name, Chunk* chunk, int offset) {
+    uint8_t name_idx     = chunk->code[offset + 1];
+    uint8_t function_idx = chunk->code[offset + 2];
+    uint16_t jump        = (uint16_t) (chunk->code[offset + 3] << 8);
+    jump                |= chunk->code[offset + 4];
+    printf("%-16s %4d '", name, name_idx);
+    value_print(chunk->constants.values[name_idx]);
+    printf("' is ");
+    value_print(chunk->constants.values[function_idx]);
+    printf(" else ->%d\n", offset + 5 + jump);
+    return offset + 5;
+}
+
+static int _instruction_property(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant_idx = chunk->code[offset + 1];
+    uint8_t entry_idx    = chunk->code[offset + 2];
+    printf("%-16s %4d '", name, constant_idx);
+    value_print(chunk->constants.values[constant_idx]);
+    printf("' entry %d\n", entry_idx);
+    return offset + 3;
+}
+
 static int _instruction_invoke(const char* name, Chunk* chunk, int offset) {
     uint8_t constant_idx = chunk->code[offset + 1];
     uint8_t arg_count    = chunk->code[offset + 2];
@@ -80,24 +104,63 @@ int instruction_disassemble(Chunk* chunk, int offset) {
         case OP_SET_LOCAL: {
             return _instruction_byte("OP_SET_LOCAL", chunk, offset);
         }
+        case OP_SET_LOCAL_POP: {
+            return _instruction_byte("OP_SET_LOCAL_POP", chunk, offset);
+        }
         case OP_SET_GLOBAL: {
             return instruction_constant("OP_SET_GLOBAL", chunk, offset);
         }
+        case OP_SET_GLOBAL_POP: {
+            return instruction_constant("OP_SET_GLOBAL_POP", chunk, offset);
+        }
         case OP_GET_UPVALUE: {
             return _instruction_byte("OP_GET_UPVALUE", chunk, offset);
         }
         case OP_SET_UPVALUE: {
             return _instruction_byte("OP_SET_UPVALUE", chunk, offset);
         }
+        case OP_SET_UPVALUE_POP: {
+            return _instruction_byte("OP_SET_UPVALUE_POP", chunk, offset);
+        }
+        case OP_GET_PARENT_LOCAL: {
+            return _instruction_byte("OP_GET_PARENT_LOCAL", chunk, offset);
+        }
+        case OP_SET_PARENT_LOCAL: {
+            return _instruction_byte("OP_SET_PARENT_LOCAL", chunk, offset);
+        }
+        case OP_SET_PARENT_LOCAL_POP: {
+            return _instruction_byte("OP_SET_PARENT_LOCAL_POP", chunk, offset);
+        }
         case OP_GET_PROPERTY: {
-            return instruction_constant("OP_GET_PROPERTY", chunk, offset);
+            return _instruction_property("OP_GET_PROPERTY", chunk, offset);
+        }
+        case OP_GET_FIELD_CACHED: {
+            return _instruction_property("OP_GET_FIELD_CACHED", chunk, offset);
         }
         case OP_SET_PROPERTY: {
             return instruction_constant("OP_SET_PROPERTY", chunk, offset);
         }
+        case OP_SET_PROPERTY_POP: {
+            return instruction_constant("OP_SET_PROPERTY_POP", chunk, offset);
+        }
         case OP_GET_SUPER: {
             return instruction_constant("OP_GET_SUPER", chunk, offset);
         }
+        case OP_BUILD_LIST: {
+            return _instruction_byte("OP_BUILD_LIST", chunk, offset);
+        }
+        case OP_BUILD_MAP: {
+            return _instruction_byte("OP_BUILD_MAP", chunk, offset);
+        }
+        case OP_BUILD_STRING: {
+            return _instruction_byte("OP_BUILD_STRING", chunk, offset);
+        }
+        case OP_INDEX_GET: {
+            return instruction_simple("OP_INDEX_GET", offset);
+        }
+        case OP_INDEX_SET: {
+            return instruction_simple("OP_INDEX_SET", offset);
+        }
         case OP_EQUAL: {
             return instruction_simple("OP_EQUAL", offset);
         }
@@ -110,6 +173,12 @@ int instruction_disassemble(Chunk* chunk, int offset) {
         case OP_ADD: {
             return instruction_simple("OP_ADD", offset);
         }
+        case OP_ADD_NUM: {
+            return instruction_simple("OP_ADD_NUM", offset);
+        }
+        case OP_ADD_STR: {
+            return instruction_simple("OP_ADD_STR", offset);
+        }
         case OP_SUBTRACT: {
             return instruction_simple("OP_SUBTRACT", offset);
         }
@@ -134,9 +203,15 @@ int instruction_disassemble(Chunk* chunk, int offset) {
         case OP_JUMP_IF_FALSE: {
             return _instruction_jump("OP_JUMP_IF_FALSE", 1, chunk, offset);
         }
+        case OP_JUMP_IF_TRUE: {
+            return _instruction_jump("OP_JUMP_IF_TRUE", 1, chunk, offset);
+        }
         case OP_LOOP: {
             return _instruction_jump("OP_LOOP", -1, chunk, offset);
         }
+        case OP_GUARD_GLOBAL: {
+            return _instruction_guard("OP_GUARD_GLOBAL", chunk, offset);
+        }
         case OP_CLOSURE: {
             offset += 1;
             uint8_t constant = chunk->code[offset++];
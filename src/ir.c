@@ -0,0 +1,698 @@
+#include <string.h>
+
+#include "ir.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define INLINE_NODES_MAX 16
+
+typedef struct Binding {
+    Scanner_Token name;
+    Ir_Node*      function;     // IR_FUNCTION bound to the name, NULL for other declarations.
+    bool          is_inlinable; // Calls through this name can be replaced by the function body.
+} Binding;
+
+typedef struct Scope {
+    struct Scope* enclosing;      // NULL for the globals.
+    int           function_depth; // Functions enclosing the scope, 0 for the script.
+    Binding*      bindings;
+    int           count;
+    int           cap;
+} Scope;
+
+static void     _scope_init(Scope* scope, Scope* enclosing);
+static void     _scope_free(Scope* scope);
+static Binding* _scope_bind(Scope* scope, Scanner_Token name, Ir_Node* function, bool is_inlinable);
+static Scope*   _scope_resolve(Scope* scope, Scanner_Token* name, Binding** binding);
+
+static bool     _tokens_equal(Scanner_Token* a, Scanner_Token* b);
+static int      _parameter_index(Ir_Node* function, Scanner_Token* name);
+static bool     _function_inlinable(Ir_Node* function);
+static bool     _body_inlinable(Ir_Node* function, Ir_Node* node, int* nodes);
+static bool     _name_assigned(Ir_Node* node, Scanner_Token* name);
+static bool     _declares_function(Ir_Node* node);
+static bool     _argument_pure(Scope* scope, Ir_Node* argument);
+static Ir_Node* _body_clone(Ir_Arena* arena, Ir_Node* function, Ir_Node* node, Ir_Node* arguments, int line);
+
+static void _resolve_statements(Ir_Arena* arena, Scope* scope, Ir_Node* statements);
+static void _resolve_statement(Ir_Arena* arena, Scope* scope, Ir_Node* node);
+static void _resolve_function(Ir_Arena* arena, Scope* scope, Ir_Node* function);
+static void _resolve_expressions(Ir_Arena* arena, Scope* scope, Ir_Node* expressions);
+static void _resolve_expression(Ir_Arena* arena, Scope* scope, Ir_Node* node);
+static void _inline_call(Ir_Arena* arena, Scope* scope, Ir_Node* node);
+static void _escape_reference(Scope* scope, Scanner_Token* name, bool is_call);
+
+static void _node_replace(Ir_Node* node, Ir_Node* with);
+static void _literal_replace(Ir_Arena* arena, Ir_Node* node, Value value);
+
+static Ir_Node* _statements_optimize(Ir_Arena* arena, Ir_Node* statements);
+static Ir_Node* _statement_optimize(Ir_Arena* arena, Ir_Node* node);
+static Ir_Node* _discard_new(Ir_Arena* arena, Ir_Node* dead, Ir_Node* live);
+static void     _expressions_optimize(Ir_Arena* arena, Ir_Node* expressions);
+static void     _expression_optimize(Ir_Arena* arena, Ir_Node* node);
+
+void ir_arena_init(Ir_Arena* arena) {
+    arena->blocks = NULL;
+    value_array_init(&arena->values);
+}
+
+void ir_arena_free(Ir_Arena* arena) {
+    Ir_Block* block = arena->blocks;
+    while (block != NULL) {
+        Ir_Block* next = block->next;
+        FREE(Ir_Block, block);
+        block = next;
+    }
+
+    value_array_free(&arena->values);
+    ir_arena_init(arena);
+}
+
+void ir_arena_mark(Ir_Arena* arena) {
+    for (int i = 0; i < arena->values.len; i += 1) {
+        mark_value(arena->values.values[i]);
+    }
+}
+
+// Keeps an object referenced from the tree alive until the arena is freed.
+void ir_value_keep(Ir_Arena* arena, Value value) {
+    if (!IS_OBJ(value)) return;
+
+    vm_stack_push(value);
+    value_array_write(&arena->values, value);
+    vm_stack_pop();
+}
+
+Ir_Node* ir_node_new(Ir_Arena* arena, Ir_Kind kind, Scanner_Token token) {
+    if (arena->blocks == NULL || arena->blocks->count == IR_BLOCK_NODES) {
+        Ir_Block* block = ALLOCATE(Ir_Block, 1);
+        block->next     = arena->blocks;
+        block->count    = 0;
+        arena->blocks   = block;
+    }
+
+    Ir_Node* node      = &arena->blocks->nodes[arena->blocks->count++];
+    node->kind         = kind;
+    node->token        = token;
+    node->a            = NULL;
+    node->b            = NULL;
+    node->c            = NULL;
+    node->next         = NULL;
+    node->value        = V_NIL;
+    node->count        = 0;
+    node->is_contained = false;
+    return node;
+}
+
+Ir_Node* ir_literal_new(Ir_Arena* arena, Scanner_Token token, Value value) {
+    ir_value_keep(arena, value);
+    Ir_Node* node = ir_node_new(arena, IR_LITERAL, token);
+    node->value   = value;
+    return node;
+}
+
+bool ir_fold_unary(Scanner_Token_Type operator_type, Value operand, Value* result) {
+    switch(operator_type) {
+        case TOKEN_BANG: {
+            *result = V_BOOL(ir_literal_is_falsey(operand));
+            return true;
+        }
+        case TOKEN_MINUS: {
+            // Leave type errors to the runtime, which reports them with a stack trace.
+            if (!IS_NUMBER(operand)) return false;
+            *result = number_value(-AS_NUMBER(operand));
+            return true;
+        }
+        default: return false; // Unreachable.
+    }
+}
+
+bool ir_fold_binary(Scanner_Token_Type operator_type, Value a, Value b, Value* result) {
+    // Mirror exactly the instructions the compiler would emit, e.g. `>=` is `!(a < b)`, so NaN behaves the same.
+    switch(operator_type) {
+        case TOKEN_BANG_EQUAL:  *result = V_BOOL(!value_equal(a, b)); return true;
+        case TOKEN_EQUAL_EQUAL: *result = V_BOOL(value_equal(a, b)); return true;
+        case TOKEN_PLUS: {
+            if (is_string(a) && is_string(b)) {
+                *result = string_concatenate(a, b);
+                return true;
+            }
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+            *result = number_value(AS_NUMBER(a) + AS_NUMBER(b));
+            return true;
+        }
+        default: break;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch(operator_type) {
+        case TOKEN_GREATER:       *result = V_BOOL(x > y); return true;
+        case TOKEN_GREATER_EQUAL: *result = V_BOOL(!(x < y)); return true;
+        case TOKEN_LESS:          *result = V_BOOL(x < y); return true;
+        case TOKEN_LESS_EQUAL:    *result = V_BOOL(!(x > y)); return true;
+        case TOKEN_MINUS:         *result = number_value(x - y); return true;
+        case TOKEN_STAR:          *result = number_value(x * y); return true;
+        case TOKEN_SLASH:         *result = number_value(x / y); return true;
+        default: return false; // Unreachable.
+    }
+}
+
+bool ir_literal_is_falsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// Inlines small functions, finds local functions that never escape their frame, folds constant expressions, resolves
+// constant conditions and drops statements that can never run.
+Ir_Node* ir_optimize(Ir_Arena* arena, Ir_Node* statements) {
+    // Globals are visible before their declaration runs, so they are all bound up front. A name declared more than
+    // once could hold either function and is left alone.
+    Scope globals;
+    _scope_init(&globals, NULL);
+    for (Ir_Node* node = statements; node != NULL; node = node->next) {
+        if (node->kind != IR_VAR && node->kind != IR_FUNCTION && node->kind != IR_CLASS) continue;
+
+        Binding* binding;
+        if (_scope_resolve(&globals, &node->token, &binding) != NULL) {
+            binding->function     = NULL;
+            binding->is_inlinable = false;
+        } else if (node->kind == IR_FUNCTION) {
+            _scope_bind(&globals, node->token, node, _function_inlinable(node));
+        } else {
+            _scope_bind(&globals, node->token, NULL, false);
+        }
+    }
+
+    _resolve_statements(arena, &globals, statements);
+    _scope_free(&globals);
+
+    return _statements_optimize(arena, statements);
+}
+
+static void _scope_init(Scope* scope, Scope* enclosing) {
+    scope->enclosing      = enclosing;
+    scope->function_depth = enclosing != NULL ? enclosing->function_depth : 0;
+    scope->bindings       = NULL;
+    scope->count          = 0;
+    scope->cap            = 0;
+}
+
+static void _scope_free(Scope* scope) {
+    FREE_ARRAY(Binding, scope->bindings, scope->cap);
+    _scope_init(scope, NULL);
+}
+
+static Binding* _scope_bind(Scope* scope, Scanner_Token name, Ir_Node* function, bool is_inlinable) {
+    if (scope->cap < scope->count + 1) {
+        int old_cap     = scope->cap;
+        scope->cap      = GROW_CAPACITY(old_cap);
+        scope->bindings = GROW_ARRAY(Binding, scope->bindings, old_cap, scope->cap);
+    }
+
+    Binding* binding = &scope->bindings[scope->count++];
+    binding->name           = name;
+    binding->function       = function;
+    binding->is_inlinable   = is_inlinable;
+    return binding;
+}
+
+// Returns the scope declaring `name`, or NULL for an undeclared global. Innermost declarations win, as in the
+// compiler.
+static Scope* _scope_resolve(Scope* scope, Scanner_Token* name, Binding** binding) {
+    for (; scope != NULL; scope = scope->enclosing) {
+        for (int i = scope->count - 1; i >= 0; i -= 1) {
+            if (_tokens_equal(&scope->bindings[i].name, name)) {
+                *binding = &scope->bindings[i];
+                return scope;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool _tokens_equal(Scanner_Token* a, Scanner_Token* b) {
+    return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+static int _parameter_index(Ir_Node* function, Scanner_Token* name) {
+    int idx = 0;
+    for (Ir_Node* parameter = function->a; parameter != NULL; parameter = parameter->next, idx += 1) {
+        if (_tokens_equal(&parameter->token, name)) return idx;
+    }
+    return -1;
+}
+
+// Only `fun f(...) { return <expression>; }` where the expression is built from literals, parameters and
+// operators. Such a body cannot capture, recurse nor have side effects.
+static bool _function_inlinable(Ir_Node* function) {
+    Ir_Node* body = function->b;
+    if (body == NULL || body->next != NULL || body->kind != IR_RETURN || body->a == NULL) return false;
+
+    int nodes = 0;
+    return _body_inlinable(function, body->a, &nodes);
+}
+
+static bool _body_inlinable(Ir_Node* function, Ir_Node* node, int* nodes) {
+    *nodes += 1;
+    if (*nodes > INLINE_NODES_MAX) return false;
+
+    switch(node->kind) {
+        case IR_LITERAL:  return true;
+        case IR_VARIABLE: return _parameter_index(function, &node->token) != -1;
+        case IR_UNARY:    return _body_inlinable(function, node->a, nodes);
+        case IR_BINARY:   return _body_inlinable(function, node->a, nodes) && _body_inlinable(function, node->b, nodes);
+        default:          return false;
+    }
+}
+
+// Looks for an assignment to `name` in `node`, its children and its siblings.
+static bool _name_assigned(Ir_Node* node, Scanner_Token* name) {
+    for (; node != NULL; node = node->next) {
+        if (node->kind == IR_ASSIGN && _tokens_equal(&node->token, name)) return true;
+        if (_name_assigned(node->a, name) || _name_assigned(node->b, name) || _name_assigned(node->c, name)) return true;
+    }
+    return false;
+}
+
+static bool _declares_function(Ir_Node* node) {
+    for (; node != NULL; node = node->next) {
+        if (node->kind == IR_FUNCTION || node->kind == IR_CLASS) return true;
+        if (_declares_function(node->a) || _declares_function(node->b) || _declares_function(node->c)) return true;
+    }
+    return false;
+}
+
+// Arguments are substituted for the parameters, so they must be free to evaluate any number of times, in any order.
+// Globals are excluded as reading an undefined one is an error.
+static bool _argument_pure(Scope* scope, Ir_Node* argument) {
+    switch(argument->kind) {
+        case IR_LITERAL:
+        case IR_THIS: return true;
+        case IR_VARIABLE: {
+            Binding* binding;
+            Scope* declaring = _scope_resolve(scope, &argument->token, &binding);
+            return declaring != NULL && declaring->enclosing != NULL;
+        }
+        default: return false;
+    }
+}
+
+// Instructions of the copy are attributed to the call line.
+static Ir_Node* _body_clone(Ir_Arena* arena, Ir_Node* function, Ir_Node* node, Ir_Node* arguments, int line) {
+    if (node->kind == IR_VARIABLE) {
+        Ir_Node* argument = arguments;
+        for (int idx = _parameter_index(function, &node->token); idx > 0; idx -= 1) {
+            argument = argument->next;
+        }
+
+        Ir_Node* clone = ir_node_new(arena, argument->kind, argument->token);
+        clone->value   = argument->value;
+        return clone;
+    }
+
+    Ir_Node* clone    = ir_node_new(arena, node->kind, node->token);
+    clone->token.line = line;
+    clone->value      = node->value;
+    if (node->a != NULL) clone->a = _body_clone(arena, function, node->a, arguments, line);
+    if (node->b != NULL) clone->b = _body_clone(arena, function, node->b, arguments, line);
+    return clone;
+}
+
+static void _resolve_statements(Ir_Arena* arena, Scope* scope, Ir_Node* statements) {
+    for (Ir_Node* node = statements; node != NULL; node = node->next) {
+        _resolve_statement(arena, scope, node);
+    }
+}
+
+static void _resolve_statement(Ir_Arena* arena, Scope* scope, Ir_Node* node) {
+    bool is_local = scope->enclosing != NULL;
+
+    switch(node->kind) {
+        case IR_EXPRESSION:
+        case IR_PRINT:
+        case IR_RETURN: {
+            if (node->a != NULL) _resolve_expression(arena, scope, node->a);
+            break;
+        }
+        case IR_VAR: {
+            if (node->a != NULL) _resolve_expression(arena, scope, node->a);
+            if (is_local) _scope_bind(scope, node->token, NULL, false);
+            break;
+        }
+        case IR_BLOCK: {
+            Scope block;
+            _scope_init(&block, scope);
+            _resolve_statements(arena, &block, node->a);
+            _scope_free(&block);
+            break;
+        }
+        case IR_IF: {
+            _resolve_expression(arena, scope, node->a);
+            _resolve_statement(arena, scope, node->b);
+            if (node->c != NULL) _resolve_statement(arena, scope, node->c);
+            break;
+        }
+        case IR_WHILE: {
+            if (node->a != NULL) _resolve_expression(arena, scope, node->a);
+            _resolve_statement(arena, scope, node->b);
+            break;
+        }
+        case IR_FUNCTION: {
+            // A local has no guard, it must keep the function for the rest of its scope. It is contained until a
+            // reference lets it escape. Functions nested in it would capture through it, so they are not supported.
+            if (is_local) {
+                bool is_reassigned = _name_assigned(node->next, &node->token);
+                _scope_bind(scope, node->token, node, _function_inlinable(node) && !is_reassigned);
+                node->is_contained = !is_reassigned && !_declares_function(node->b);
+            }
+            _resolve_function(arena, scope, node);
+            break;
+        }
+        case IR_CLASS: {
+            if (is_local) _scope_bind(scope, node->token, NULL, false);
+            for (Ir_Node* method = node->b; method != NULL; method = method->next) {
+                _resolve_function(arena, scope, method);
+            }
+            break;
+        }
+        default: break; // Unreachable.
+    }
+}
+
+static void _resolve_function(Ir_Arena* arena, Scope* scope, Ir_Node* function) {
+    Scope body;
+    _scope_init(&body, scope);
+    body.function_depth += 1;
+    for (Ir_Node* parameter = function->a; parameter != NULL; parameter = parameter->next) {
+        _scope_bind(&body, parameter->token, NULL, false);
+    }
+
+    _resolve_statements(arena, &body, function->b);
+    _scope_free(&body);
+}
+
+static void _resolve_expressions(Ir_Arena* arena, Scope* scope, Ir_Node* expressions) {
+    for (Ir_Node* node = expressions; node != NULL; node = node->next) {
+        _resolve_expression(arena, scope, node);
+    }
+}
+
+static void _resolve_expression(Ir_Arena* arena, Scope* scope, Ir_Node* node) {
+    switch(node->kind) {
+        case IR_VARIABLE: {
+            _escape_reference(scope, &node->token, false);
+            break;
+        }
+        case IR_ASSIGN: {
+            _escape_reference(scope, &node->token, false);
+            _resolve_expression(arena, scope, node->a);
+            break;
+        }
+        case IR_UNARY:
+        case IR_GET_PROPERTY: {
+            _resolve_expression(arena, scope, node->a);
+            break;
+        }
+        case IR_BINARY:
+        case IR_AND:
+        case IR_OR:
+        case IR_SET_PROPERTY:
+        case IR_INDEX_GET: {
+            _resolve_expression(arena, scope, node->a);
+            _resolve_expression(arena, scope, node->b);
+            break;
+        }
+        case IR_INDEX_SET: {
+            _resolve_expression(arena, scope, node->a);
+            _resolve_expression(arena, scope, node->b);
+            _resolve_expression(arena, scope, node->c);
+            break;
+        }
+        case IR_LIST:
+        case IR_MAP:
+        case IR_INTERPOLATION: {
+            _resolve_expressions(arena, scope, node->a);
+            break;
+        }
+        case IR_INVOKE: {
+            _resolve_expression(arena, scope, node->a);
+            _resolve_expressions(arena, scope, node->b);
+            break;
+        }
+        case IR_SUPER_INVOKE: {
+            _resolve_expressions(arena, scope, node->b);
+            break;
+        }
+        case IR_CALL: {
+            if (node->a->kind == IR_VARIABLE) {
+                _escape_reference(scope, &node->a->token, true);
+            } else {
+                _resolve_expression(arena, scope, node->a);
+            }
+            _resolve_expressions(arena, scope, node->b);
+            _inline_call(arena, scope, node);
+            break;
+        }
+        default: break; // Leaves.
+    }
+}
+
+static void _inline_call(Ir_Arena* arena, Scope* scope, Ir_Node* node) {
+    if (node->a->kind != IR_VARIABLE) return;
+
+    Binding* binding;
+    Scope* declaring = _scope_resolve(scope, &node->a->token, &binding);
+    if (declaring == NULL || !binding->is_inlinable) return;
+
+    Ir_Node* function = binding->function;
+    if (node->count != function->count) return;
+    for (Ir_Node* argument = node->b; argument != NULL; argument = argument->next) {
+        if (!_argument_pure(scope, argument)) return;
+    }
+
+    Ir_Node* body = _body_clone(arena, function, function->b->a, node->b, node->token.line);
+
+    if (declaring->enclosing != NULL) {
+        _node_replace(node, body);
+        return;
+    }
+
+    // The global may be reassigned or not defined yet, the original call is kept behind a guard.
+    Ir_Node* call = ir_node_new(arena, IR_CALL, node->token);
+    *call         = *node;
+    call->next    = NULL;
+
+    node->kind  = IR_INLINE;
+    node->token = call->a->token;
+    node->a     = body;
+    node->b     = call;
+    node->c     = function;
+}
+
+// A local function stays contained while it is only called by name from the function declaring it, its closure then
+// never outlives that frame and can read the frame's locals directly.
+static void _escape_reference(Scope* scope, Scanner_Token* name, bool is_call) {
+    Binding* binding;
+    Scope* declaring = _scope_resolve(scope, name, &binding);
+    if (declaring == NULL || binding->function == NULL) return;
+
+    if (!is_call || declaring->function_depth != scope->function_depth) {
+        binding->function->is_contained = false;
+    }
+}
+
+static void _node_replace(Ir_Node* node, Ir_Node* with) {
+    Ir_Node* next = node->next;
+    *node         = *with;
+    node->next    = next;
+}
+
+static void _literal_replace(Ir_Arena* arena, Ir_Node* node, Value value) {
+    ir_value_keep(arena, value);
+    node->kind  = IR_LITERAL;
+    node->value = value;
+    node->a     = NULL;
+    node->b     = NULL;
+    node->c     = NULL;
+}
+
+static Ir_Node* _statements_optimize(Ir_Arena* arena, Ir_Node* statements) {
+    Ir_Node** link = &statements;
+
+    while (*link != NULL) {
+        Ir_Node* node        = *link;
+        Ir_Node* replacement = _statement_optimize(arena, node);
+
+        if (replacement == NULL) {
+            *link = node->next;
+            continue;
+        }
+
+        if (replacement != node) {
+            replacement->next = node->next;
+            *link             = replacement;
+        }
+
+        // Nothing after a return or a loop without exit can run.
+        Ir_Node* live = replacement->kind == IR_DISCARD ? replacement->b : replacement;
+        if (live != NULL && (live->kind == IR_RETURN || (live->kind == IR_WHILE && live->a == NULL))) {
+            if (replacement->next != NULL) replacement->next = _discard_new(arena, replacement->next, NULL);
+            break;
+        }
+
+        link = &replacement->next;
+    }
+
+    return statements;
+}
+
+// Returns the statement to use in place of `node`, NULL when it can be removed.
+static Ir_Node* _statement_optimize(Ir_Arena* arena, Ir_Node* node) {
+    switch(node->kind) {
+        case IR_EXPRESSION: {
+            _expression_optimize(arena, node->a);
+            return node->a->kind == IR_LITERAL ? NULL : node;
+        }
+        case IR_PRINT: {
+            _expression_optimize(arena, node->a);
+            return node;
+        }
+        case IR_VAR:
+        case IR_RETURN: {
+            if (node->a != NULL) _expression_optimize(arena, node->a);
+            return node;
+        }
+        case IR_BLOCK: {
+            node->a = _statements_optimize(arena, node->a);
+            return node->a == NULL ? NULL : node;
+        }
+        case IR_IF: {
+            _expression_optimize(arena, node->a);
+            node->b = _statement_optimize(arena, node->b);
+            if (node->c != NULL) node->c = _statement_optimize(arena, node->c);
+
+            if (node->a->kind == IR_LITERAL) {
+                bool is_falsey = ir_literal_is_falsey(node->a->value);
+                return _discard_new(arena, is_falsey ? node->b : node->c, is_falsey ? node->c : node->b);
+            }
+            return node;
+        }
+        case IR_WHILE: {
+            if (node->a != NULL) _expression_optimize(arena, node->a);
+            node->b = _statement_optimize(arena, node->b);
+
+            if (node->a != NULL && node->a->kind == IR_LITERAL) {
+                if (ir_literal_is_falsey(node->a->value)) return _discard_new(arena, node->b, NULL);
+                node->a = NULL;
+            }
+            return node;
+        }
+        case IR_FUNCTION: {
+            node->b = _statements_optimize(arena, node->b);
+            return node;
+        }
+        case IR_CLASS: {
+            for (Ir_Node* method = node->b; method != NULL; method = method->next) {
+                method->b = _statements_optimize(arena, method->b);
+            }
+            return node;
+        }
+        default: return node; // Unreachable.
+    }
+}
+
+// Dead code still goes through lowering, where the errors depending on scopes are reported, so a file is rejected
+// for the same mistakes as the REPL. Returns `live` when nothing is dead.
+static Ir_Node* _discard_new(Ir_Arena* arena, Ir_Node* dead, Ir_Node* live) {
+    if (dead == NULL) return live;
+
+    Ir_Node* node = ir_node_new(arena, IR_DISCARD, dead->token);
+    node->a       = dead;
+    node->b       = live;
+    return node;
+}
+
+static void _expressions_optimize(Ir_Arena* arena, Ir_Node* expressions) {
+    for (Ir_Node* node = expressions; node != NULL; node = node->next) {
+        _expression_optimize(arena, node);
+    }
+}
+
+static void _expression_optimize(Ir_Arena* arena, Ir_Node* node) {
+    switch(node->kind) {
+        case IR_UNARY: {
+            _expression_optimize(arena, node->a);
+
+            Value result;
+            if (node->a->kind == IR_LITERAL && ir_fold_unary(node->token.type, node->a->value, &result)) {
+                _literal_replace(arena, node, result);
+            }
+            break;
+        }
+        case IR_BINARY: {
+            _expression_optimize(arena, node->a);
+            _expression_optimize(arena, node->b);
+
+            Value result;
+            if (node->a->kind == IR_LITERAL && node->b->kind == IR_LITERAL && ir_fold_binary(node->token.type, node->a->value, node->b->value, &result)) {
+                _literal_replace(arena, node, result);
+            }
+            break;
+        }
+        case IR_AND:
+        case IR_OR: {
+            _expression_optimize(arena, node->a);
+            _expression_optimize(arena, node->b);
+
+            // `and` yields its left operand when falsey, `or` when truthy.
+            if (node->a->kind == IR_LITERAL) {
+                bool is_falsey = ir_literal_is_falsey(node->a->value);
+                bool is_left   = node->kind == IR_AND ? is_falsey : !is_falsey;
+                _node_replace(node, is_left ? node->a : node->b);
+            }
+            break;
+        }
+        case IR_ASSIGN:
+        case IR_GET_PROPERTY: {
+            _expression_optimize(arena, node->a);
+            break;
+        }
+        case IR_SET_PROPERTY:
+        case IR_INDEX_GET: {
+            _expression_optimize(arena, node->a);
+            _expression_optimize(arena, node->b);
+            break;
+        }
+        case IR_INDEX_SET: {
+            _expression_optimize(arena, node->a);
+            _expression_optimize(arena, node->b);
+            _expression_optimize(arena, node->c);
+            break;
+        }
+        case IR_LIST:
+        case IR_MAP:
+        case IR_INTERPOLATION: {
+            _expressions_optimize(arena, node->a);
+            break;
+        }
+        case IR_CALL:
+        case IR_INVOKE: {
+            _expression_optimize(arena, node->a);
+            _expressions_optimize(arena, node->b);
+            break;
+        }
+        case IR_SUPER_INVOKE: {
+            _expressions_optimize(arena, node->b);
+            break;
+        }
+        case IR_INLINE: {
+            _expression_optimize(arena, node->a);
+            _expression_optimize(arena, node->b);
+            break;
+        }
+        default: break; // Leaves.
+    }
+}
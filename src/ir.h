@@ -0,0 +1,85 @@
+#ifndef INTERP_IR_H
+
+#include "common.h"
+#include "scanner.h"
+#include "value.h"
+
+typedef enum Ir_Kind {
+    // Expressions.
+    IR_LITERAL,       // value
+    IR_UNARY,         // token is the operator, a
+    IR_BINARY,        // token is the operator, a, b
+    IR_AND,           // a, b
+    IR_OR,            // a, b
+    IR_VARIABLE,      // token is the name
+    IR_ASSIGN,        // token is the name, a
+    IR_CALL,          // a is the callee, b the arguments, count
+    IR_GET_PROPERTY,  // token is the name, a
+    IR_SET_PROPERTY,  // token is the name, a the object, b the value
+    IR_INVOKE,        // token is the name, a the receiver, b the arguments, count
+    IR_THIS,          // token is `this`
+    IR_SUPER_GET,     // token is the method name, a the `super` variable
+    IR_SUPER_INVOKE,  // token is the method name, a the `super` variable, b the arguments, count
+    IR_INLINE,        // token is the global name, a the inlined body, b the original IR_CALL, c the IR_FUNCTION inlined
+    IR_LIST,          // a the elements, count
+    IR_MAP,           // a the keys each followed by its value, count the entries
+    IR_INTERPOLATION, // a the string parts and expressions in order, count
+    IR_INDEX_GET,     // a the list or map, b the index
+    IR_INDEX_SET,     // a the list or map, b the index, c the value
+
+    // Statements.
+    IR_EXPRESSION,    // a
+    IR_PRINT,         // a
+    IR_VAR,           // token is the name, a the initializer or NULL
+    IR_BLOCK,         // a the statements
+    IR_IF,            // a the condition, b then, c else or NULL
+    IR_WHILE,         // a the condition or NULL to loop forever, b the body
+    IR_RETURN,        // a the value or NULL
+    IR_FUNCTION,      // token is the name, a the parameters as IR_VARIABLE, b the body, count the arity, value the
+                      // Obj_Function once an IR_INLINE guard needs it
+    IR_CLASS,         // token is the name, a the superclass IR_VARIABLE or NULL, b the methods as IR_FUNCTION
+    IR_DISCARD,       // a the statements that can never run, only lowered for their errors, b the one to run or NULL
+} Ir_Kind;
+
+typedef struct Ir_Node {
+    Ir_Kind         kind;
+    Scanner_Token   token;
+    struct Ir_Node* a;
+    struct Ir_Node* b;
+    struct Ir_Node* c;
+    struct Ir_Node* next;  // Sibling in statement, argument, parameter and method lists.
+    Value           value;
+    int             count;
+    bool            is_contained; // IR_FUNCTION only called by name from the function declaring it.
+} Ir_Node;
+
+#define IR_BLOCK_NODES 256
+
+typedef struct Ir_Block {
+    struct Ir_Block* next;
+    int              count;
+    Ir_Node          nodes[IR_BLOCK_NODES];
+} Ir_Block;
+
+// Nodes live until the whole tree is lowered, and are then released at once.
+typedef struct Ir_Arena {
+    Ir_Block*   blocks;
+    Value_Array values; // Objects referenced by literals, kept alive during collections.
+} Ir_Arena;
+
+void ir_arena_init(Ir_Arena* arena);
+void ir_arena_free(Ir_Arena* arena);
+void ir_arena_mark(Ir_Arena* arena);
+
+void     ir_value_keep(Ir_Arena* arena, Value value);
+Ir_Node* ir_node_new(Ir_Arena* arena, Ir_Kind kind, Scanner_Token token);
+Ir_Node* ir_literal_new(Ir_Arena* arena, Scanner_Token token, Value value);
+
+bool ir_fold_unary(Scanner_Token_Type operator_type, Value operand, Value* result);
+bool ir_fold_binary(Scanner_Token_Type operator_type, Value a, Value b, Value* result);
+bool ir_literal_is_falsey(Value value);
+
+Ir_Node* ir_optimize(Ir_Arena* arena, Ir_Node* statements);
+
+#define INTERP_IR_H
+#endif
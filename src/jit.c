@@ -0,0 +1,716 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "memory.h"
+
+#ifdef JIT_ENABLED
+
+#include <sys/mman.h>
+
+// Baseline compiler: each instruction of a chunk becomes a fixed x86-64 template, stitched in bytecode order.
+// Loads, stores, numeric arithmetic and jumps run inline, everything else calls the runtime helper for the
+// opcode, which returns to the interpreter when it pushes or pops a frame.
+//
+// Registers, callee saved so they survive helper calls:
+//   rbx  stack top, stored back to `vm.stack_top` around each helper call.
+//   r12  frame slots.
+//   r13  &vm.stack_top.
+
+typedef Jit_Status (*Jit_Entry)(Value* slots, uint8_t* target);
+
+typedef struct Jit_Patch {
+    int at;     // Offset of a rel32 in code.
+    int target; // Chunk offset jumped to, -1 for the exit.
+} Jit_Patch;
+
+typedef struct Assembler {
+    uint8_t*   code;
+    int        len;
+    int        cap;
+    Jit_Patch* patches;
+    int        patch_count;
+    int        patch_cap;
+} Assembler;
+
+#define EMIT(as, ...) _emit((as), (uint8_t[]) {__VA_ARGS__}, sizeof((uint8_t[]) {__VA_ARGS__}))
+
+static bool     _is_inline(uint8_t op);
+static Value    _constant_double(Value value);
+static uint8_t* _code_map(Assembler* as, size_t* size);
+
+static void _emit(Assembler* as, const uint8_t* bytes, int count);
+static void _emit_u32(Assembler* as, uint32_t value);
+static void _emit_u64(Assembler* as, uint64_t value);
+static void _emit_rel32(Assembler* as, int target);
+static int  _emit_forward(Assembler* as);
+static void _forward_resolve(Assembler* as, int at);
+
+static void _emit_push(Assembler* as, Value value);
+static void _emit_helper(Assembler* as, Jit_Helper helper, uint8_t* ip);
+static void _emit_numeric(Assembler* as, uint8_t op, Jit_Helper helper, uint8_t* ip);
+static void _emit_jump_falsey(Assembler* as, bool is_falsey, int target);
+
+Jit_Code* jit_compile(Chunk* chunk, Jit_Helper* helpers, Value** stack_top) {
+    for (int offset = 0; offset < chunk->len;) {
+        int length = chunk_instruction_length(chunk, offset);
+        if (length == 0 || (helpers[chunk->code[offset]] == NULL && !_is_inline(chunk->code[offset]))) return NULL;
+        offset += length;
+    }
+
+    Assembler as = {0};
+    int* entries = ALLOCATE(int, chunk->len);
+    for (int i = 0; i < chunk->len; i += 1) {
+        entries[i] = -1;
+    }
+
+    // Entry: push rbx; push r12; push r13; mov r12, rdi; mov r13, stack_top; mov rbx, [r13]; jmp rsi
+    EMIT(&as, 0x53, 0x41, 0x54, 0x41, 0x55, 0x49, 0x89, 0xfc, 0x49, 0xbd);
+    _emit_u64(&as, (uint64_t) (uintptr_t) stack_top);
+    EMIT(&as, 0x49, 0x8b, 0x5d, 0x00, 0xff, 0xe6);
+
+    // Exit, with the status in eax: pop r13; pop r12; pop rbx; ret
+    int exit_offset = as.len;
+    EMIT(&as, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+
+    for (int offset = 0; offset < chunk->len;) {
+        uint8_t* ip     = &chunk->code[offset];
+        int length      = chunk_instruction_length(chunk, offset);
+        int end         = offset + length;
+        int jump        = length >= 3 ? (ip[length - 2] << 8) | ip[length - 1] : 0;
+        entries[offset] = as.len;
+
+        switch (ip[0]) {
+            case OP_CONSTANT: _emit_push(&as, _constant_double(chunk->constants.values[ip[1]])); break;
+            case OP_NIL:      _emit_push(&as, V_NIL); break;
+            case OP_TRUE:     _emit_push(&as, V_TRUE); break;
+            case OP_FALSE:    _emit_push(&as, V_FALSE); break;
+            case OP_POP: {
+                EMIT(&as, 0x48, 0x83, 0xeb, 0x08); // sub rbx, 8
+                break;
+            }
+            case OP_GET_LOCAL: {
+                EMIT(&as, 0x49, 0x8b, 0x84, 0x24); // mov rax, [r12 + slot * 8]
+                _emit_u32(&as, ip[1] * sizeof(Value));
+                EMIT(&as, 0x48, 0x89, 0x03, 0x48, 0x83, 0xc3, 0x08); // mov [rbx], rax; add rbx, 8
+                break;
+            }
+            case OP_SET_LOCAL:
+            case OP_SET_LOCAL_POP: {
+                EMIT(&as, 0x48, 0x8b, 0x43, 0xf8, 0x49, 0x89, 0x84, 0x24); // mov rax, [rbx - 8]; mov [r12 + slot * 8], rax
+                _emit_u32(&as, ip[1] * sizeof(Value));
+                if (ip[0] == OP_SET_LOCAL_POP) EMIT(&as, 0x48, 0x83, 0xeb, 0x08);
+                break;
+            }
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_ADD_STR:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE: {
+                _emit_numeric(&as, ip[0], helpers[ip[0]], ip);
+                break;
+            }
+            case OP_JUMP: {
+                EMIT(&as, 0xe9);
+                _emit_rel32(&as, end + jump);
+                break;
+            }
+            case OP_LOOP: {
+                EMIT(&as, 0xe9);
+                _emit_rel32(&as, end - jump);
+                break;
+            }
+            case OP_JUMP_IF_FALSE: _emit_jump_falsey(&as, true, end + jump); break;
+            case OP_JUMP_IF_TRUE:  _emit_jump_falsey(&as, false, end + jump); break;
+            case OP_GUARD_GLOBAL: {
+                _emit_helper(&as, helpers[ip[0]], ip);
+                EMIT(&as, 0x85, 0xc0, 0x0f, 0x85); // test eax, eax; jne
+                _emit_rel32(&as, end + jump);
+                break;
+            }
+            default: {
+                _emit_helper(&as, helpers[ip[0]], ip);
+                EMIT(&as, 0x85, 0xc0, 0x0f, 0x85); // test eax, eax; jne exit
+                _emit_rel32(&as, -1);
+                break;
+            }
+        }
+
+        offset = end;
+    }
+
+    for (int i = 0; i < as.patch_count; i += 1) {
+        Jit_Patch* patch = &as.patches[i];
+        int destination  = patch->target == -1 ? exit_offset : entries[patch->target];
+        int32_t rel      = destination - (patch->at + 4);
+        memcpy(&as.code[patch->at], &rel, sizeof(rel));
+    }
+
+    Jit_Code* jit = NULL;
+    size_t size;
+    uint8_t* code = _code_map(&as, &size);
+    if (code != NULL) {
+        jit          = ALLOCATE(Jit_Code, 1);
+        jit->code    = code;
+        jit->size    = size;
+        jit->entries = entries;
+        jit->len     = chunk->len;
+    }
+
+    if (jit == NULL) FREE_ARRAY(int, entries, chunk->len);
+    FREE_ARRAY(uint8_t, as.code, as.cap);
+    FREE_ARRAY(Jit_Patch, as.patches, as.patch_cap);
+    return jit;
+}
+
+Jit_Status jit_enter(Jit_Code* jit, Value* slots, int offset) {
+    // ISO C has no conversion from a data pointer to a function pointer.
+    Jit_Entry entry;
+    memcpy(&entry, &jit->code, sizeof(entry));
+    return entry(slots, jit->code + jit->entries[offset]);
+}
+
+void jit_free(Jit_Code* jit) {
+    munmap(jit->code, jit->size);
+    FREE_ARRAY(int, jit->entries, jit->len);
+    FREE(Jit_Code, jit);
+}
+
+// Instructions compiled without a helper.
+static bool _is_inline(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+            return true;
+        default: return false;
+    }
+}
+
+// The templates only inline arithmetic on doubles, small int constants are widened once here.
+static Value _constant_double(Value value) {
+    return IS_INT(value) ? V_NUMBER(AS_INT(value)) : value;
+}
+
+// Executable copy of the assembled code, NULL when the system refuses one.
+static uint8_t* _code_map(Assembler* as, size_t* size) {
+    uint8_t* code = mmap(NULL, as->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) return NULL;
+
+    memcpy(code, as->code, as->len);
+    if (mprotect(code, as->len, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, as->len);
+        return NULL;
+    }
+
+    *size = as->len;
+    return code;
+}
+
+static void _emit(Assembler* as, const uint8_t* bytes, int count) {
+    if (as->len + count > as->cap) {
+        int cap  = as->cap;
+        as->cap  = GROW_CAPACITY(as->cap);
+        while (as->len + count > as->cap) as->cap *= 2;
+        as->code = GROW_ARRAY(uint8_t, as->code, cap, as->cap);
+    }
+
+    memcpy(&as->code[as->len], bytes, count);
+    as->len += count;
+}
+
+static void _emit_u32(Assembler* as, uint32_t value) {
+    _emit(as, (uint8_t*) &value, sizeof(value));
+}
+
+static void _emit_u64(Assembler* as, uint64_t value) {
+    _emit(as, (uint8_t*) &value, sizeof(value));
+}
+
+// A rel32 to an instruction of the chunk, resolved once every instruction has been emitted.
+static void _emit_rel32(Assembler* as, int target) {
+    if (as->patch_count + 1 > as->patch_cap) {
+        int cap       = as->patch_cap;
+        as->patch_cap = GROW_CAPACITY(cap);
+        as->patches   = GROW_ARRAY(Jit_Patch, as->patches, cap, as->patch_cap);
+    }
+
+    as->patches[as->patch_count++] = (Jit_Patch) {.at = as->len, .target = target};
+    _emit_u32(as, 0);
+}
+
+// A rel32 to a later point of the same template, see `_forward_resolve`.
+static int _emit_forward(Assembler* as) {
+    _emit_u32(as, 0);
+    return as->len - 4;
+}
+
+static void _forward_resolve(Assembler* as, int at) {
+    int32_t rel = as->len - (at + 4);
+    memcpy(&as->code[at], &rel, sizeof(rel));
+}
+
+static void _emit_push(Assembler* as, Value value) {
+    EMIT(as, 0x48, 0xb8); // mov rax, value
+    _emit_u64(as, value);
+    EMIT(as, 0x48, 0x89, 0x03, 0x48, 0x83, 0xc3, 0x08); // mov [rbx], rax; add rbx, 8
+}
+
+// Leaves the helper's status in eax.
+static void _emit_helper(Assembler* as, Jit_Helper helper, uint8_t* ip) {
+    EMIT(as, 0x49, 0x89, 0x5d, 0x00, 0x48, 0xbf); // mov [r13], rbx; mov rdi, ip
+    _emit_u64(as, (uint64_t) (uintptr_t) ip);
+    EMIT(as, 0x48, 0xb8); // mov rax, helper
+    _emit_u64(as, (uint64_t) (uintptr_t) helper);
+    EMIT(as, 0xff, 0xd0, 0x49, 0x8b, 0x5d, 0x00); // call rax; mov rbx, [r13]
+}
+
+// Two numbers are computed inline, anything else goes through the helper for strings and errors.
+static void _emit_numeric(Assembler* as, uint8_t op, Jit_Helper helper, uint8_t* ip) {
+    EMIT(as, 0x48, 0x8b, 0x43, 0xf0, 0x48, 0x8b, 0x4b, 0xf8, 0x48, 0xba); // mov rax, [rbx - 16]; mov rcx, [rbx - 8]; mov rdx, QNAN
+    _emit_u64(as, QNAN);
+    EMIT(as, 0x48, 0x89, 0xc6, 0x48, 0x21, 0xd6, 0x48, 0x39, 0xd6, 0x0f, 0x84); // mov rsi, rax; and rsi, rdx; cmp rsi, rdx; je slow
+    int slow_a = _emit_forward(as);
+    EMIT(as, 0x48, 0x89, 0xce, 0x48, 0x21, 0xd6, 0x48, 0x39, 0xd6, 0x0f, 0x84); // mov rsi, rcx; and rsi, rdx; cmp rsi, rdx; je slow
+    int slow_b = _emit_forward(as);
+    EMIT(as, 0x66, 0x48, 0x0f, 0x6e, 0xc0, 0x66, 0x48, 0x0f, 0x6e, 0xc9); // movq xmm0, rax; movq xmm1, rcx
+
+    switch (op) {
+        case OP_GREATER:
+        case OP_LESS: {
+            if (op == OP_GREATER) {
+                EMIT(as, 0x66, 0x0f, 0x2e, 0xc1); // ucomisd xmm0, xmm1
+            } else {
+                EMIT(as, 0x66, 0x0f, 0x2e, 0xc8); // ucomisd xmm1, xmm0
+            }
+            EMIT(as, 0x48, 0xb8); // mov rax, false
+            _emit_u64(as, V_FALSE);
+            EMIT(as, 0x48, 0xb9); // mov rcx, true
+            _emit_u64(as, V_TRUE);
+            EMIT(as, 0x48, 0x0f, 0x47, 0xc1); // cmova rax, rcx, unordered compares as false
+            break;
+        }
+        default: {
+            uint8_t sse_op = op == OP_SUBTRACT ? 0x5c : op == OP_MULTIPLY ? 0x59 : op == OP_DIVIDE ? 0x5e : 0x58;
+            EMIT(as, 0xf2, 0x0f, sse_op, 0xc1, 0x66, 0x48, 0x0f, 0x7e, 0xc0); // op xmm0, xmm1; movq rax, xmm0
+            break;
+        }
+    }
+
+    EMIT(as, 0x48, 0x89, 0x43, 0xf0, 0x48, 0x83, 0xeb, 0x08, 0xe9); // mov [rbx - 16], rax; sub rbx, 8; jmp done
+    int done = _emit_forward(as);
+
+    _forward_resolve(as, slow_a);
+    _forward_resolve(as, slow_b);
+    _emit_helper(as, helper, ip);
+    EMIT(as, 0x85, 0xc0, 0x0f, 0x85); // test eax, eax; jne exit
+    _emit_rel32(as, -1);
+    _forward_resolve(as, done);
+}
+
+// Jumps when the value on top of the stack is (or is not) nil or false, leaving it there.
+static void _emit_jump_falsey(Assembler* as, bool is_falsey, int target) {
+    EMIT(as, 0x48, 0x8b, 0x43, 0xf8, 0x48, 0xb9); // mov rax, [rbx - 8]; mov rcx, nil
+    _emit_u64(as, V_NIL);
+    EMIT(as, 0x48, 0x39, 0xc8, 0x0f, 0x84); // cmp rax, rcx; je
+    int nil = is_falsey ? -1 : _emit_forward(as);
+    if (is_falsey) _emit_rel32(as, target);
+    EMIT(as, 0x48, 0xb9); // mov rcx, false
+    _emit_u64(as, V_FALSE);
+    EMIT(as, 0x48, 0x39, 0xc8, 0x0f, 0x84); // cmp rax, rcx; je
+    if (is_falsey) {
+        _emit_rel32(as, target);
+        return;
+    }
+
+    int falsey = _emit_forward(as);
+    EMIT(as, 0xe9);
+    _emit_rel32(as, target);
+    _forward_resolve(as, nil);
+    _forward_resolve(as, falsey);
+}
+
+// Traces: the interpreter hands over a loop header once its back edge got hot. One iteration is recorded by
+// running it on copies of the locals, and compiled along the way for the types and branches it saw. Numbers stay
+// unboxed in xmm registers, a NaN-boxed number being its double already. Each branch becomes a guard whose side exit
+// writes the stack back and returns the offset the interpreter resumes at.
+//
+// Registers:
+//   r12          frame slots.
+//   r13          &vm.stack_top.
+//   xmm0-xmm13   entries pushed above the stack top at the loop header, comparisons as all ones or zero masks.
+//   xmm15        scratch.
+
+#define TRACE_REGISTERS 14
+
+typedef struct Trace_Entry {
+    Value value;    // Seen while recording, a number or a bool.
+    bool  is_known; // A bool already guarded, its register is not read anymore.
+} Trace_Entry;
+
+typedef struct Trace_Recorder {
+    Assembler   as;
+    Chunk*      chunk;
+    int         header;
+    int         base;       // Stack depth at the header, the locals below stay in memory.
+    Value*      locals;     // Their values while recording.
+    bool*       is_read;    // Read before being written, checked to hold numbers when entering the trace.
+    bool*       is_written;
+    Trace_Entry stack[TRACE_REGISTERS];
+    int         depth;      // Entries above base.
+    int         epilogue;
+} Trace_Recorder;
+
+static bool _trace_iteration(Trace_Recorder* recorder, int loop_top);
+static bool _trace_push(Trace_Recorder* recorder, Value value);
+static void _trace_exit(Trace_Recorder* recorder, int resume);
+
+static void _emit_sse(Assembler* as, uint8_t prefix, uint8_t op, int reg, int rm);
+static void _emit_sse_slot(Assembler* as, uint8_t op, int reg, int slot);
+static void _emit_xmm_load(Assembler* as, int reg, uint64_t bits);
+static void _emit_movq_rax(Assembler* as, int reg);
+static void _emit_backward(Assembler* as, int target);
+static void _emit_slot(Assembler* as, uint8_t op, int slot);
+
+Jit_Trace* jit_trace_record(Chunk* chunk, int header, Value* slots, int base, Value** stack_top) {
+    if (base > UINT8_COUNT) return NULL;
+
+    Trace_Recorder recorder = {0};
+    recorder.chunk          = chunk;
+    recorder.header         = header;
+    recorder.base           = base;
+    recorder.locals         = ALLOCATE(Value, base);
+    recorder.is_read        = ALLOCATE(bool, base);
+    recorder.is_written     = ALLOCATE(bool, base);
+    for (int i = 0; i < base; i += 1) {
+        recorder.locals[i]     = slots[i];
+        recorder.is_read[i]    = false;
+        recorder.is_written[i] = false;
+    }
+
+    // Entry: push r12; push r13; mov r12, rdi; mov r13, stack_top; jmp preamble
+    Assembler* as = &recorder.as;
+    EMIT(as, 0x41, 0x54, 0x41, 0x55, 0x49, 0x89, 0xfc, 0x49, 0xbd);
+    _emit_u64(as, (uint64_t) (uintptr_t) stack_top);
+    EMIT(as, 0xe9);
+    int preamble = _emit_forward(as);
+
+    // Exit, with the offset to resume at in eax: pop r13; pop r12; ret
+    recorder.epilogue = as->len;
+    EMIT(as, 0x41, 0x5d, 0x41, 0x5c, 0xc3);
+
+    int loop_top = as->len;
+    Jit_Trace* trace = NULL;
+    if (_trace_iteration(&recorder, loop_top)) {
+        // The locals read are numbers on entry, and stay so as the trace only stores numbers to them.
+        // Small ints are widened to doubles in their slot first.
+        _forward_resolve(as, preamble);
+        int fails[UINT8_COUNT];
+        int fail_count = 0;
+        for (int i = 0; i < base; i += 1) {
+            if (!recorder.is_read[i]) continue;
+            _emit_slot(as, 0x8b, i); // mov rax, [r12 + slot * 8]
+            EMIT(as, 0x48, 0xb9);    // mov rcx, QNAN | TAG_INT
+            _emit_u64(as, QNAN | TAG_INT);
+            EMIT(as, 0x48, 0x89, 0xc2, 0x48, 0x21, 0xca, 0x48, 0x39, 0xca, 0x75); // mov rdx, rax; and rdx, rcx; cmp rdx, rcx; jne
+            EMIT(as, 0x00);
+            int not_int = as->len;
+            EMIT(as, 0x48, 0x63, 0xc0, 0xf2, 0x4c, 0x0f, 0x2a, 0xf8); // movsxd rax, eax; cvtsi2sd xmm15, rax
+            _emit_sse_slot(as, 0x11, 15, i);                          // movsd [r12 + slot * 8], xmm15
+            EMIT(as, 0xeb, 0x00);
+            int next = as->len;
+            as->code[not_int - 1] = (uint8_t) (as->len - not_int);
+            EMIT(as, 0x48, 0xb9);    // mov rcx, QNAN
+            _emit_u64(as, QNAN);
+            EMIT(as, 0x48, 0x21, 0xc8, 0x48, 0x39, 0xc8, 0x0f, 0x84); // and rax, rcx; cmp rax, rcx; je fail
+            fails[fail_count++] = _emit_forward(as);
+            as->code[next - 1] = (uint8_t) (as->len - next);
+        }
+        EMIT(as, 0xe9);
+        _emit_backward(as, loop_top);
+
+        for (int i = 0; i < fail_count; i += 1) {
+            _forward_resolve(as, fails[i]);
+        }
+        EMIT(as, 0xb8); // mov eax, header
+        _emit_u32(as, header);
+        EMIT(as, 0xe9);
+        _emit_backward(as, recorder.epilogue);
+
+        size_t size;
+        uint8_t* code = _code_map(as, &size);
+        if (code != NULL) {
+            trace       = ALLOCATE(Jit_Trace, 1);
+            trace->code = code;
+            trace->size = size;
+        }
+    }
+
+    FREE_ARRAY(Value, recorder.locals, base);
+    FREE_ARRAY(bool, recorder.is_read, base);
+    FREE_ARRAY(bool, recorder.is_written, base);
+    FREE_ARRAY(uint8_t, as->code, as->cap);
+    return trace;
+}
+
+int jit_trace_run(Jit_Trace* trace, Value* slots) {
+    int (*entry)(Value* slots);
+    memcpy(&entry, &trace->code, sizeof(entry));
+    return entry(slots);
+}
+
+void jit_trace_free(Jit_Trace* trace) {
+    munmap(trace->code, trace->size);
+    FREE(Jit_Trace, trace);
+}
+
+// Follows the path one iteration takes from the header back to it. False when it leaves the subset traces handle:
+// numbers and comparisons on locals, with no calls, globals or objects.
+static bool _trace_iteration(Trace_Recorder* recorder, int loop_top) {
+    Assembler* as = &recorder->as;
+    Chunk* chunk  = recorder->chunk;
+    int offset    = recorder->header;
+
+    for (int count = 0; count < TRACE_LENGTH_MAX; count += 1) {
+        uint8_t* ip     = &chunk->code[offset];
+        int length      = chunk_instruction_length(chunk, offset);
+        int end         = offset + length;
+        int jump        = length >= 3 ? (ip[length - 2] << 8) | ip[length - 1] : 0;
+        int top         = recorder->depth - 1;
+        Trace_Entry* a  = top >= 1 ? &recorder->stack[top - 1] : NULL;
+        Trace_Entry* b  = top >= 0 ? &recorder->stack[top] : NULL;
+
+        switch (ip[0]) {
+            case OP_CONSTANT: {
+                Value value = _constant_double(chunk->constants.values[ip[1]]);
+                if (!IS_NUMBER(value) || !_trace_push(recorder, value)) return false;
+                _emit_xmm_load(as, top + 1, value);
+                break;
+            }
+            case OP_TRUE:
+            case OP_FALSE: {
+                if (!_trace_push(recorder, V_BOOL(ip[0] == OP_TRUE))) return false;
+                recorder->stack[top + 1].is_known = true;
+                break;
+            }
+            case OP_POP: {
+                if (b == NULL) return false;
+                recorder->depth -= 1;
+                break;
+            }
+            case OP_GET_LOCAL: {
+                int slot = ip[1];
+                if (slot < recorder->base) {
+                    Value value = recorder->locals[slot];
+                    if (!IS_NUMBER(value) || !_trace_push(recorder, value)) return false;
+                    if (!recorder->is_written[slot]) recorder->is_read[slot] = true;
+                    _emit_sse_slot(as, 0x10, top + 1, slot); // movsd xmm, [r12 + slot * 8]
+                } else {
+                    Trace_Entry entry = recorder->stack[slot - recorder->base];
+                    if (!_trace_push(recorder, entry.value)) return false;
+                    recorder->stack[top + 1] = entry;
+                    _emit_sse(as, 0x66, 0x28, top + 1, slot - recorder->base); // movapd
+                }
+                break;
+            }
+            case OP_SET_LOCAL:
+            case OP_SET_LOCAL_POP: {
+                int slot = ip[1];
+                if (b == NULL) return false;
+                if (slot < recorder->base) {
+                    if (!IS_NUMBER(b->value)) return false;
+                    recorder->locals[slot]     = b->value;
+                    recorder->is_written[slot] = true;
+                    _emit_sse_slot(as, 0x11, top, slot); // movsd [r12 + slot * 8], xmm
+                } else {
+                    recorder->stack[slot - recorder->base] = *b;
+                    _emit_sse(as, 0x66, 0x28, slot - recorder->base, top); // movapd
+                }
+                if (ip[0] == OP_SET_LOCAL_POP) recorder->depth -= 1;
+                break;
+            }
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE: {
+                if (a == NULL || !IS_NUMBER(a->value) || !IS_NUMBER(b->value)) return false;
+                double x = AS_NUMBER(a->value);
+                double y = AS_NUMBER(b->value);
+                switch (ip[0]) {
+                    case OP_SUBTRACT: a->value = V_NUMBER(x - y); _emit_sse(as, 0xf2, 0x5c, top - 1, top); break;
+                    case OP_MULTIPLY: a->value = V_NUMBER(x * y); _emit_sse(as, 0xf2, 0x59, top - 1, top); break;
+                    case OP_DIVIDE:   a->value = V_NUMBER(x / y); _emit_sse(as, 0xf2, 0x5e, top - 1, top); break;
+                    default:          a->value = V_NUMBER(x + y); _emit_sse(as, 0xf2, 0x58, top - 1, top); break;
+                }
+                recorder->depth -= 1;
+                break;
+            }
+            case OP_EQUAL:
+            case OP_LESS:
+            case OP_GREATER: {
+                if (a == NULL || !IS_NUMBER(a->value) || !IS_NUMBER(b->value)) return false;
+                double x = AS_NUMBER(a->value);
+                double y = AS_NUMBER(b->value);
+                if (ip[0] == OP_GREATER) {
+                    a->value = V_BOOL(x > y);
+                    _emit_sse(as, 0x66, 0x28, 15, top);     // movapd xmm15, b
+                    _emit_sse(as, 0xf2, 0xc2, 15, top - 1); // cmpltsd xmm15, a
+                    EMIT(as, 0x01);
+                    _emit_sse(as, 0x66, 0x28, top - 1, 15); // movapd a, xmm15
+                } else {
+                    a->value = V_BOOL(ip[0] == OP_LESS ? x < y : x == y);
+                    _emit_sse(as, 0xf2, 0xc2, top - 1, top); // cmpltsd or cmpeqsd
+                    EMIT(as, ip[0] == OP_LESS ? 0x01 : 0x00);
+                }
+                a->is_known = false;
+                recorder->depth -= 1;
+                break;
+            }
+            case OP_NOT: {
+                if (b == NULL || !IS_BOOL(b->value)) return false;
+                b->value = V_BOOL(!AS_BOOL(b->value));
+                if (!b->is_known) {
+                    _emit_xmm_load(as, 15, UINT64_MAX);
+                    _emit_sse(as, 0x66, 0x57, top, 15); // xorpd
+                }
+                break;
+            }
+            case OP_NEGATE: {
+                if (b == NULL || !IS_NUMBER(b->value)) return false;
+                b->value = V_NUMBER(-AS_NUMBER(b->value));
+                _emit_xmm_load(as, 15, SIGN_BIT);
+                _emit_sse(as, 0x66, 0x57, top, 15); // xorpd
+                break;
+            }
+            case OP_JUMP: {
+                end += jump;
+                break;
+            }
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE: {
+                if (b == NULL || !IS_BOOL(b->value)) return false;
+                bool is_taken = AS_BOOL(b->value) == (ip[0] == OP_JUMP_IF_TRUE);
+                int other     = is_taken ? end : end + jump;
+                if (is_taken) end += jump;
+                if (b->is_known) break;
+
+                // movq rax, xmm; test rax, rax; jnz or jz to the recorded path
+                _emit_movq_rax(as, top);
+                EMIT(as, 0x48, 0x85, 0xc0, 0x0f, AS_BOOL(b->value) ? 0x85 : 0x84);
+                int recorded = _emit_forward(as);
+
+                b->value    = V_BOOL(!AS_BOOL(b->value));
+                b->is_known = true;
+                _trace_exit(recorder, other);
+                b->value    = V_BOOL(!AS_BOOL(b->value));
+                _forward_resolve(as, recorded);
+                break;
+            }
+            case OP_LOOP: {
+                if (end - jump != recorder->header || recorder->depth != 0) return false;
+                EMIT(as, 0xe9);
+                _emit_backward(as, loop_top);
+                return true;
+            }
+            default: return false;
+        }
+
+        offset = end;
+    }
+
+    return false;
+}
+
+static bool _trace_push(Trace_Recorder* recorder, Value value) {
+    if (recorder->depth == TRACE_REGISTERS) return false;
+    recorder->stack[recorder->depth++] = (Trace_Entry) {.value = value, .is_known = false};
+    return true;
+}
+
+// Boxes the entries back onto the stack and returns to the interpreter at resume.
+static void _trace_exit(Trace_Recorder* recorder, int resume) {
+    Assembler* as = &recorder->as;
+    for (int i = 0; i < recorder->depth; i += 1) {
+        Trace_Entry* entry = &recorder->stack[i];
+        int slot           = recorder->base + i;
+        if (IS_NUMBER(entry->value)) {
+            _emit_sse_slot(as, 0x11, i, slot); // movsd [r12 + slot * 8], xmm
+            continue;
+        }
+
+        if (entry->is_known) {
+            EMIT(as, 0x48, 0xb8); // mov rax, value
+            _emit_u64(as, entry->value);
+        } else {
+            _emit_movq_rax(as, i);
+            EMIT(as, 0x48, 0x85, 0xc0, 0x48, 0xb8); // test rax, rax; mov rax, false
+            _emit_u64(as, V_FALSE);
+            EMIT(as, 0x48, 0xb9); // mov rcx, true
+            _emit_u64(as, V_TRUE);
+            EMIT(as, 0x48, 0x0f, 0x45, 0xc1); // cmovnz rax, rcx
+        }
+        _emit_slot(as, 0x89, slot); // mov [r12 + slot * 8], rax
+    }
+
+    _emit_slot(as, 0x8d, recorder->base + recorder->depth); // lea rax, [r12 + depth * 8]
+    EMIT(as, 0x49, 0x89, 0x45, 0x00, 0xb8);                 // mov [r13], rax; mov eax, resume
+    _emit_u32(as, resume);
+    EMIT(as, 0xe9);
+    _emit_backward(as, recorder->epilogue);
+}
+
+// prefix [REX] 0f op, with xmm registers for both operands.
+static void _emit_sse(Assembler* as, uint8_t prefix, uint8_t op, int reg, int rm) {
+    uint8_t modrm = 0xc0 | (reg & 7) << 3 | (rm & 7);
+    if (reg >= 8 || rm >= 8) {
+        EMIT(as, prefix, 0x40 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0), 0x0f, op, modrm);
+    } else {
+        EMIT(as, prefix, 0x0f, op, modrm);
+    }
+}
+
+// movsd between an xmm register and [r12 + slot * 8].
+static void _emit_sse_slot(Assembler* as, uint8_t op, int reg, int slot) {
+    EMIT(as, 0xf2, 0x41 | (reg >= 8 ? 0x04 : 0), 0x0f, op, 0x84 | (reg & 7) << 3, 0x24);
+    _emit_u32(as, slot * sizeof(Value));
+}
+
+// mov rax, bits; movq xmm, rax
+static void _emit_xmm_load(Assembler* as, int reg, uint64_t bits) {
+    EMIT(as, 0x48, 0xb8);
+    _emit_u64(as, bits);
+    EMIT(as, 0x66, 0x48 | (reg >= 8 ? 0x04 : 0), 0x0f, 0x6e, 0xc0 | (reg & 7) << 3);
+}
+
+// movq rax, xmm
+static void _emit_movq_rax(Assembler* as, int reg) {
+    EMIT(as, 0x66, 0x48 | (reg >= 8 ? 0x04 : 0), 0x0f, 0x7e, 0xc0 | (reg & 7) << 3);
+}
+
+// A rel32 to code already emitted.
+static void _emit_backward(Assembler* as, int target) {
+    _emit_u32(as, (uint32_t) (target - (as->len + 4)));
+}
+
+// op between rax and [r12 + slot * 8], with op 0x8b to load, 0x89 to store and 0x8d for the address.
+static void _emit_slot(Assembler* as, uint8_t op, int slot) {
+    EMIT(as, 0x49, op, 0x84, 0x24);
+    _emit_u32(as, slot * sizeof(Value));
+}
+
+#undef EMIT
+
+#endif
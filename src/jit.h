@@ -0,0 +1,58 @@
+#ifndef INTERP_JIT_H
+
+#include "common.h"
+#include "chunk.h"
+#include "value.h"
+
+// The templates work on NaN-boxed values with the System V calling convention, elsewhere everything is interpreted.
+#if defined(OPTIMIZE_JIT) && defined(NAN_BOXING) && defined(__x86_64__) && defined(__linux__)
+#define JIT_ENABLED
+#endif
+
+#define JIT_HOT_CALLS    64
+#define TRACE_HOT_LOOPS  64
+#define TRACE_LENGTH_MAX 512 // Instructions recorded before giving up on a loop.
+
+typedef enum Jit_Status {
+    JIT_CONTINUE, // Run the next instruction.
+    JIT_BRANCH,   // Take the instruction's jump, only returned by the OP_GUARD_GLOBAL helper.
+    JIT_CALL,     // A frame was pushed.
+    JIT_RETURN,   // The frame returned to its caller.
+    JIT_DONE,     // The script returned.
+    JIT_ERROR,
+} Jit_Status;
+
+// Runs the instruction at ip for the top frame, once the stack top is in `vm.stack_top`.
+typedef Jit_Status (*Jit_Helper)(uint8_t* ip);
+
+typedef struct Jit_Code {
+    uint8_t* code;
+    size_t   size;
+    int*     entries; // Offset in code of each instruction by its offset in the chunk, -1 inside instructions.
+    int      len;
+} Jit_Code;
+
+// Machine code for one iteration of a loop, run until a guard fails.
+typedef struct Jit_Trace {
+    uint8_t* code;
+    size_t   size;
+} Jit_Trace;
+
+// A loop header of interpreted code, by its offset in the chunk.
+typedef struct Jit_Loop {
+    int        header;
+    int        hotness;     // Back edges taken before the trace was recorded, up to TRACE_HOT_LOOPS.
+    bool       is_rejected; // Recording failed, the loop stays interpreted.
+    Jit_Trace* trace;       // NULL until recorded, or when the loop could not be.
+} Jit_Loop;
+
+Jit_Code*  jit_compile(Chunk* chunk, Jit_Helper* helpers, Value** stack_top);
+Jit_Status jit_enter(Jit_Code* jit, Value* slots, int offset);
+void       jit_free(Jit_Code* jit);
+
+Jit_Trace* jit_trace_record(Chunk* chunk, int header, Value* slots, int base, Value** stack_top);
+int        jit_trace_run(Jit_Trace* trace, Value* slots);
+void       jit_trace_free(Jit_Trace* trace);
+
+#define INTERP_JIT_H
+#endif
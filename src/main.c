@@ -16,8 +16,12 @@
 #include "table.c"
 #include "object.c"
 #include "chunk.c"
+#include "number.c"
 #include "scanner.c"
 #include "compiler.c"
+#include "ir.c"
+#include "optimizer.c"
+#include "jit.c"
 #include "debug.c"
 
 static void  _repl(void);
@@ -50,13 +54,17 @@ static void _repl(void) {
             break;
         }
 
-        vm_interpret(line);
+        vm_interpret(line, COMPILE_SINGLE_PASS);
     }
 }
 
 static void _file_run(const char* path) {
     char* source = _file_read(path);
-    Interpret_Result result = vm_interpret(source);
+    #ifdef OPTIMIZE_IR
+    Interpret_Result result = vm_interpret(source, COMPILE_IR);
+    #else
+    Interpret_Result result = vm_interpret(source, COMPILE_SINGLE_PASS);
+    #endif
     free(source);
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
@@ -1,16 +1,41 @@
+#include <stdio.h>
 #include <stdlib.h>
 
+#ifdef COMPRESSED_REFS
+#include <sys/mman.h>
+#endif
+
+// The sanitizers don't know the heap region, it is registered as a leak root and freed objects are poisoned.
+#if defined(__SANITIZE_ADDRESS__)
+#define HEAP_SANITIZED
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define HEAP_SANITIZED
+#endif
+#endif
+
+#if defined(COMPRESSED_REFS) && defined(HEAP_SANITIZED)
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/lsan_interface.h>
+#define HEAP_POISON(object, size)   ASAN_POISON_MEMORY_REGION(object, size)
+#define HEAP_UNPOISON(object, size) ASAN_UNPOISON_MEMORY_REGION(object, size)
+#else
+#define HEAP_POISON(object, size)   ((void) 0)
+#define HEAP_UNPOISON(object, size) ((void) 0)
+#endif
+
 #include "compiler.h"
+#include "jit.h"
 #include "memory.h"
 #include "vm.h"
 
 #ifdef DEBUG_LOG_GC
-#include <stdio.h>
 #include "debug.h"
 #endif
 
 static void _mark_roots(void);
 static void _trace_references(void);
+static void _bound_methods_prune(void);
 static void _sweep(void);
 static void _mark_array(Value_Array* array);
 
@@ -19,6 +44,30 @@ static void _blacken_object(Obj* object);
 
 #define GC_HEAP_GROW_FACTOR 2
 
+#ifdef COMPRESSED_REFS
+#define HEAP_SIZE         ((size_t) UINT32_MAX << HEAP_SHIFT) // Everything a ref can address.
+#define HEAP_COMMIT       (1024 * 1024)                       // Made accessible this much at a time.
+#define HEAP_SIZE_MIN     (64 * HEAP_COMMIT)                  // Smallest reservation tried when address space is limited.
+#define HEAP_SIZE_CLASSES 256                                 // Objects up to 255 times 8 bytes, the class fits the header.
+
+#define HEAP_FREE         0xff                                // Type of a freed block.
+
+// A freed block keeps its size class, so walking the region steps over it.
+typedef struct Heap_Free {
+    Obj     obj;
+    Obj_Ref next; // Heap_Free
+} Heap_Free;
+
+uint8_t* heap_base;
+
+static size_t     _heap_size;                            // Reserved, less than HEAP_SIZE when it could not all be.
+static size_t     _heap_top;                             // Offset of the never allocated part of the region.
+static size_t     _heap_committed;                       // Offset past the accessible part.
+static Heap_Free* _heap_free_lists[HEAP_SIZE_CLASSES]; // By size class.
+#endif
+
+static void _memory_fail(const char* message);
+
 void* reallocate(void* pointer, size_t old_size, size_t new_size) {
     vm.bytes_allocated += new_size - old_size;
 
@@ -37,10 +86,105 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size) {
     }
 
     void* result = realloc(pointer, new_size);
-    if (result == NULL) exit(1);
+    if (result == NULL) _memory_fail("Out of memory.");
     return result;
 }
 
+void mem_heap_init(void) {
+    #ifdef COMPRESSED_REFS
+    // Only reserved, the allocated part is made accessible as it grows. Refs address any smaller region just as well,
+    // so a limit on the address space (`ulimit -v`) only limits the heap.
+    void* region = MAP_FAILED;
+    for (_heap_size = HEAP_SIZE; _heap_size >= HEAP_SIZE_MIN; _heap_size /= 2) {
+        region = mmap(NULL, _heap_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region != MAP_FAILED) break;
+    }
+    if (region == MAP_FAILED) _memory_fail("Could not reserve address space for the heap.");
+
+    heap_base       = region;
+    _heap_top       = HEAP_ALIGN; // Ref 0 is NULL, nothing lives at the base.
+    _heap_committed = 0;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i += 1) {
+        _heap_free_lists[i] = NULL;
+    }
+
+    #ifdef HEAP_SANITIZED
+    __lsan_register_root_region(heap_base, _heap_size); // Only its accessible part is scanned.
+    #endif
+    #endif
+}
+
+void mem_heap_free(void) {
+    #ifdef COMPRESSED_REFS
+    #ifdef HEAP_SANITIZED
+    __lsan_unregister_root_region(heap_base, _heap_size);
+    #endif
+    munmap(heap_base, _heap_size);
+    heap_base = NULL;
+    #endif
+}
+
+void* mem_object_allocate(size_t size) {
+    #ifdef COMPRESSED_REFS
+    size_t class = (size + HEAP_ALIGN - 1) / HEAP_ALIGN;
+    if (class >= HEAP_SIZE_CLASSES) _memory_fail("Object too large for the heap.");
+
+    // Collects like reallocate, before reusing a free object.
+    vm.bytes_allocated += class * HEAP_ALIGN;
+    #ifdef DEBUG_STRESS_GC
+        collect_garbage();
+    #endif
+    if (vm.bytes_allocated > vm.next_gc) {
+        collect_garbage();
+    }
+
+    Obj* object = (Obj*) _heap_free_lists[class];
+    if (object != NULL) {
+        HEAP_UNPOISON(object, class * HEAP_ALIGN);
+        _heap_free_lists[class] = obj_deref(_heap_free_lists[class]->next);
+    } else {
+        if (_heap_top + class * HEAP_ALIGN > _heap_committed) {
+            if (_heap_committed + HEAP_COMMIT > _heap_size) _memory_fail("Out of memory, the heap is full.");
+            if (mprotect(heap_base + _heap_committed, HEAP_COMMIT, PROT_READ | PROT_WRITE) != 0) {
+                _memory_fail("Out of memory, could not grow the heap.");
+            }
+            _heap_committed += HEAP_COMMIT;
+        }
+
+        object     = (Obj*) (heap_base + _heap_top);
+        _heap_top += class * HEAP_ALIGN;
+    }
+
+    object->size_class = (uint8_t) class;
+    return object;
+    #else
+    Obj* object = (Obj*) reallocate(NULL, 0, size);
+    object->next = vm.objects;
+    vm.objects   = object;
+    return object;
+    #endif
+}
+
+static void _memory_fail(const char* message) {
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+}
+
+void mem_object_free(void* object, size_t size) {
+    #ifdef COMPRESSED_REFS
+    size_t class = (size + HEAP_ALIGN - 1) / HEAP_ALIGN;
+    vm.bytes_allocated -= class * HEAP_ALIGN;
+
+    Heap_Free* block        = object;
+    block->obj.type         = HEAP_FREE;
+    block->next             = obj_ref(_heap_free_lists[class]);
+    _heap_free_lists[class] = block;
+    HEAP_POISON((uint8_t*) block + sizeof(Heap_Free), class * HEAP_ALIGN - sizeof(Heap_Free));
+    #else
+    reallocate(object, size, 0);
+    #endif
+}
+
 void collect_garbage(void) {
     #ifdef DEBUG_LOG_GC
         printf("-- gc begin\n");
@@ -49,9 +193,13 @@ void collect_garbage(void) {
 
     _mark_roots();
     _trace_references();
-    table_remove_white(&vm.strings);
+    _bound_methods_prune();
     _sweep();
     vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    #ifdef COMPRESSED_REFS
+    // The sweep walks the whole region, so as much is allocated again before the next one.
+    if (vm.next_gc < _heap_top) vm.next_gc = _heap_top;
+    #endif
 
     #ifdef DEBUG_LOG_GC
         printf("-- gc end\n");
@@ -68,13 +216,17 @@ static void _mark_roots(void) {
         mark_object((Obj*) vm.frames[i].closure);
     }
 
-    for (Obj_Upvalue* upvalue = vm.open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+    for (Obj_Upvalue* upvalue = vm.open_upvalues; upvalue != NULL; upvalue = obj_deref(upvalue->next)) {
         mark_object((Obj*) upvalue);
     }
 
     mark_table(&vm.globals);
     mark_compiler_roots();
     mark_object((Obj*) vm.init_string);
+
+    for (int i = 0; i < vm.selectors.len; i += 1) {
+        mark_value(vm.selectors.values[i]);
+    }
 }
 
 static void _trace_references(void) {
@@ -91,25 +243,39 @@ static void _blacken_object(Obj* object) {
         printf("\n");
     #endif
 
-    switch(object->type) {
+    switch((Obj_Type) object->type) {
         case OBJ_BOUND_METHOD: {
             Obj_Bound_Method* bound = (Obj_Bound_Method*) object;
             mark_value(bound->receiver);
-            mark_object((Obj*) bound->method);
+            mark_object(obj_deref(bound->method));
             break;
         }
         case OBJ_CLASS: {
             Obj_Class* class = (Obj_Class*) object;
-            mark_object((Obj*) class->name);
-            mark_table(&class->methods);
+            mark_object(obj_deref(class->name));
+            for (int i = 0; i < class->method_count; i += 1) {
+                mark_object(obj_deref(class->methods[i]));
+            }
             break;
         }
         case OBJ_INSTANCE: {
             Obj_Instance* instance = (Obj_Instance*) object;
-            mark_object((Obj*) instance->class);
+            mark_object(obj_deref(instance->class));
             mark_table(&instance->fields);
             break;
         }
+        case OBJ_LIST: {
+            _mark_array(&((Obj_List*) object)->items);
+            break;
+        }
+        case OBJ_MAP: {
+            mark_table(&((Obj_Map*) object)->table);
+            break;
+        }
+        case OBJ_SLICE: {
+            mark_object(obj_deref(((Obj_Slice*) object)->string));
+            break;
+        }
         case OBJ_UPVALUE: {
             mark_value(((Obj_Upvalue*) object)->closed);
             break;
@@ -122,9 +288,9 @@ static void _blacken_object(Obj* object) {
         }
         case OBJ_CLOSURE: {
             Obj_Closure* closure = (Obj_Closure*) object;
-            mark_object((Obj*) closure->function);
+            mark_object(obj_deref(closure->function));
             for (int i = 0; i < closure->upvalue_count; i += 1) {
-                mark_object((Obj*) closure->upvalues[i]);
+                mark_object(obj_deref(closure->upvalues[i]));
             }
             break;
         }
@@ -134,7 +300,40 @@ static void _blacken_object(Obj* object) {
     }
 }
 
+// Bound method caches hold their methods weakly. An unreached one leaves a nil value under its name, which stays
+// alive as a selector.
+static void _bound_methods_prune(void) {
+    int count = 0;
+    for (int i = 0; i < vm.bound_receiver_count; i += 1) {
+        Obj_Instance* instance = (Obj_Instance*) vm.bound_receivers[i];
+        if (!instance->obj.is_marked) continue; // Swept with its cache.
+
+        Table* cache = instance->bound_methods;
+        for (int j = 0; j < cache->cap; j += 1) {
+            Value method = cache->entries[j].value;
+            if (IS_OBJ(method) && !AS_OBJ(method)->is_marked) cache->entries[j].value = V_NIL;
+        }
+        vm.bound_receivers[count++] = (Obj*) instance;
+    }
+    vm.bound_receiver_count = count;
+}
+
 static void _sweep(void) {
+    #ifdef COMPRESSED_REFS
+    for (uint8_t* block = heap_base + HEAP_ALIGN; block < heap_base + _heap_top;) {
+        Obj* object = (Obj*) block;
+        block      += object->size_class * HEAP_ALIGN;
+
+        if (object->type == HEAP_FREE) continue;
+        if (object->is_marked) {
+            object->is_marked = false;
+            continue;
+        }
+
+        if (object->type == OBJ_STRING) string_set_delete(&vm.strings, (Obj_String*) object);
+        _free_object(object);
+    }
+    #else
     Obj* previous = NULL;
     Obj* object   = vm.objects;
 
@@ -142,20 +341,22 @@ static void _sweep(void) {
         if (object->is_marked) {
             object->is_marked = false;
             previous          = object;
-            object            = object->next;
+            object            = obj_deref(object->next);
         } else {
             Obj* unreached = object;
-            object         = object->next;
+            object         = obj_deref(object->next);
 
             if(previous != NULL) {
-                previous->next = object;
+                previous->next = obj_ref(object);
             } else {
                 vm.objects = object;
             }
 
+            if (unreached->type == OBJ_STRING) string_set_delete(&vm.strings, (Obj_String*) unreached);
             _free_object(unreached);
         }
     }
+    #endif
 }
 
 void mark_value(Value value) {
@@ -177,7 +378,7 @@ void mark_object(Obj* object) {
     if (vm.gray_capacity < vm.gray_count + 1) {
         vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
         vm.gray_stack = (Obj**) realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
-        if (vm.gray_stack == NULL) exit(1);
+        if (vm.gray_stack == NULL) _memory_fail("Out of memory.");
     }
 
     vm.gray_stack[vm.gray_count++] = object;
@@ -190,6 +391,13 @@ static void _mark_array(Value_Array* array) {
 }
 
 void mem_free_objects(void) {
+    #ifdef COMPRESSED_REFS
+    for (uint8_t* block = heap_base + HEAP_ALIGN; block < heap_base + _heap_top;) {
+        Obj* object = (Obj*) block;
+        block      += object->size_class * HEAP_ALIGN;
+        if (object->type != HEAP_FREE) _free_object(object);
+    }
+    #else
     Obj* object = vm.objects;
 
     while(object != NULL) {
@@ -197,8 +405,10 @@ void mem_free_objects(void) {
         _free_object(object);
         object = next;
     }
+    #endif
 
     free(vm.gray_stack);
+    free(vm.bound_receivers);
 }
 
 static void _free_object(Obj* object) {
@@ -206,47 +416,72 @@ static void _free_object(Obj* object) {
         printf("%p free type %d\n", (void*) object, object->type);
     #endif
 
-    switch(object->type) {
+    switch((Obj_Type) object->type) {
         case OBJ_BOUND_METHOD: {
-            FREE(Obj_Bound_Method, object);
+            FREE_OBJ(Obj_Bound_Method, object);
             break;
         }
         case OBJ_CLASS: {
             Obj_Class* class = (Obj_Class*) object;
-            table_free(&class->methods);
-            FREE(Obj_Class, object);
+            FREE_ARRAY(Obj_Ref, class->methods, class->method_count);
+            FREE_OBJ(Obj_Class, object);
             break;
         }
         case OBJ_CLOSURE: {
-            Obj_Closure* closure = (Obj_Closure*)object;
-            FREE_ARRAY(Obj_Upvalue*, closure->upvalues, closure->upvalue_count);
-            FREE(Obj_Closure, object);
+            Obj_Closure* closure = (Obj_Closure*) object;
+            mem_object_free(object, CLOSURE_SIZE(closure->upvalue_count));
             break;
         }
         case OBJ_FUNCTION: {
             Obj_Function* function = (Obj_Function*) object;
+            #ifdef JIT_ENABLED
+            if (function->jit != NULL) jit_free(function->jit);
+            for (int i = 0; i < function->loop_count; i += 1) {
+                if (function->loops[i].trace != NULL) jit_trace_free(function->loops[i].trace);
+            }
+            FREE_ARRAY(Jit_Loop, function->loops, function->loop_cap);
+            #endif
             chunk_free(&function->chunk);
-            FREE(Obj_Function, object);
+            FREE_OBJ(Obj_Function, object);
             break;
         }
         case OBJ_INSTANCE: {
             Obj_Instance* instance = (Obj_Instance*) object;
             table_free(&instance->fields);
-            FREE(Obj_Instance, object);
+            if (instance->bound_methods != NULL) {
+                table_free(instance->bound_methods);
+                FREE(Table, instance->bound_methods);
+            }
+            FREE_OBJ(Obj_Instance, object);
+            break;
+        }
+        case OBJ_LIST: {
+            Obj_List* list = (Obj_List*) object;
+            value_array_free(&list->items);
+            FREE_OBJ(Obj_List, object);
+            break;
+        }
+        case OBJ_MAP: {
+            table_free(&((Obj_Map*) object)->table);
+            FREE_OBJ(Obj_Map, object);
             break;
         }
         case OBJ_NATIVE: {
-            FREE(Obj_Native, object);
+            FREE_OBJ(Obj_Native, object);
+            break;
+        }
+        case OBJ_SLICE: {
+            FREE_OBJ(Obj_Slice, object);
             break;
         }
         case OBJ_STRING: {
             Obj_String* string = (Obj_String*) object;
             FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(Obj_String, object);
+            FREE_OBJ(Obj_String, object);
             break;
         }
         case OBJ_UPVALUE: {
-            FREE(Obj_Upvalue, object);
+            FREE_OBJ(Obj_Upvalue, object);
             break;
         }
     }
@@ -6,10 +6,12 @@
 #include "common.h"
 #include "object.h"
 
-#define ALLOCATE(type, count) (type*) reallocate(NULL, 0, sizeof(type) * count)
+#define ALLOCATE(type, count) (type*) reallocate(NULL, 0, sizeof(type) * (count))
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+#define FREE_OBJ(type, pointer) mem_object_free(pointer, sizeof(type))
+
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
 #define GROW_ARRAY(type, pointer, old_capacity, new_capacity) (type*) reallocate(pointer, sizeof(type) * (old_capacity), sizeof(type) * (new_capacity))
@@ -18,6 +20,13 @@
 
 void* reallocate(void* pointer, size_t old_size, size_t new_size);
 
+// Objects themselves, not the arrays they own, live in the heap region when refs are compressed.
+// Otherwise they are linked from `vm.objects`.
+void  mem_heap_init(void);
+void  mem_heap_free(void);
+void* mem_object_allocate(size_t size);
+void  mem_object_free(void* object, size_t size);
+
 void collect_garbage(void);
 
 void mark_value(Value value);
@@ -0,0 +1,10 @@
+#ifndef INTERP_NUMBER_H
+
+#include "common.h"
+
+// Reads all of `chars` as a decimal like `-12.5e3` into the nearest double, whatever the locale.
+// Returns false when it isn't one.
+bool number_parse(const char* chars, int length, double* num);
+
+#define INTERP_NUMBER_H
+#endif
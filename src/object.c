@@ -9,14 +9,18 @@
 
 #define _ALLOCATE_OBJ(type, obj_type) (type*) _object_allocate(sizeof(type), obj_type)
 
+#define PRINT_DEPTH_MAX 64 // Containers printed inside one another, deeper ones print as `[...]` or `{...}`.
+
+static Obj* _printing[PRINT_DEPTH_MAX]; // The containers being printed, outermost first.
+static int  _printing_count;
+
 static void _function_print(Obj_Function* function);
+static bool _print_enter(Obj* object);
 
 static Obj* _object_allocate(size_t size, Obj_Type type) {
-    Obj* object       = (Obj*) reallocate(NULL, 0, size);
+    Obj* object       = (Obj*) mem_object_allocate(size);
     object->type      = type;
     object->is_marked = false;
-    object->next      = vm.objects;
-    vm.objects        = object;
 
     #ifdef DEBUG_LOG_GC
         printf("%p allocate %zu for %d\n", (void*) object, size, type);
@@ -30,8 +34,10 @@ static Obj_String* _string_allocate(char* chars, int length, uint32_t hash) {
     string->length     = length;
     string->chars      = chars;
     string->hash       = hash;
+    string->is_guarded = false;
+    string->selector   = -1;
     vm_stack_push(V_OBJ(string));
-    table_set(&vm.strings, string, V_NIL);
+    string_set_add(&vm.strings, string);
     vm_stack_pop();
     return string;
 }
@@ -49,7 +55,7 @@ static uint32_t _string_hash(const char* key, int length) {
 Obj_String* string_copy(const char* chars, int length) {
     uint32_t hash = _string_hash(chars, length);
 
-    Obj_String* interned = table_find_string(&vm.strings, chars, length, hash);
+    Obj_String* interned = string_set_find(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
 
     char* heap_chars = ALLOCATE(char, length + 1);
@@ -62,7 +68,7 @@ Obj_String* string_copy(const char* chars, int length) {
 Obj_String* string_take(char* chars, int length) {
     uint32_t hash = _string_hash(chars, length);
 
-    Obj_String* interned = table_find_string(&vm.strings, chars, length, hash);
+    Obj_String* interned = string_set_find(&vm.strings, chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
@@ -71,11 +77,95 @@ Obj_String* string_take(char* chars, int length) {
     return _string_allocate(chars, length, hash);
 }
 
+Value string_value(const char* chars, int length) {
+    #ifdef NAN_BOXING
+    if (length <= SHORT_STRING_MAX) return short_string_value(chars, length);
+    #endif
+    return V_OBJ(string_copy(chars, length));
+}
+
+// `buffer` holds SHORT_STRING_MAX + 1 bytes, a short string's characters are copied there.
+const char* string_value_chars(Value value, char* buffer, int* length) {
+    #ifdef NAN_BOXING
+    if (IS_SHORT_STRING(value)) {
+        short_string_chars(value, buffer);
+        *length = short_string_length(value);
+        return buffer;
+    }
+    #else
+    (void) buffer;
+    #endif
+
+    if (IS_SLICE(value)) {
+        Obj_Slice* slice = AS_SLICE(value);
+        *length          = slice->length;
+        return ((Obj_String*) obj_deref(slice->string))->chars + slice->start;
+    }
+
+    *length = AS_STRING(value)->length;
+    return AS_STRING(value)->chars;
+}
+
+// Callers keep both operands reachable, they must survive a collection here.
+Value string_concatenate(Value a, Value b) {
+    char a_buffer[SHORT_STRING_MAX + 1];
+    char b_buffer[SHORT_STRING_MAX + 1];
+    int  a_length;
+    int  b_length;
+    const char* a_chars = string_value_chars(a, a_buffer, &a_length);
+    const char* b_chars = string_value_chars(b, b_buffer, &b_length);
+
+    int length = a_length + b_length;
+    if (length <= SHORT_STRING_MAX) {
+        char chars[SHORT_STRING_MAX + 1];
+        memcpy(chars, a_chars, a_length);
+        memcpy(chars + a_length, b_chars, b_length);
+        return string_value(chars, length);
+    }
+
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, a_chars, a_length);
+    memcpy(chars + a_length, b_chars, b_length);
+    chars[length] = '\0';
+    return V_OBJ(string_take(chars, length));
+}
+
+// `string` must be reachable, the range within it is checked by the caller.
+Value string_slice(Value string, int start, int length) {
+    char buffer[SHORT_STRING_MAX + 1];
+    int  string_length;
+    const char* chars = string_value_chars(string, buffer, &string_length);
+    if (length <= SHORT_STRING_MAX) return string_value(chars + start, length);
+    if (length == string_length) return string;
+
+    Obj_Ref parent = IS_SLICE(string) ? AS_SLICE(string)->string : obj_ref(AS_STRING(string));
+    if (IS_SLICE(string)) start += AS_SLICE(string)->start;
+
+    Obj_Slice* slice = _ALLOCATE_OBJ(Obj_Slice, OBJ_SLICE);
+    slice->string    = parent;
+    slice->start     = start;
+    slice->length    = length;
+    return V_OBJ(slice);
+}
+
+// Interned and short strings are equal when their values are, slices compare their characters.
+bool string_equal(Value a, Value b) {
+    if (!is_string(a) || !is_string(b)) return false;
+
+    char a_buffer[SHORT_STRING_MAX + 1];
+    char b_buffer[SHORT_STRING_MAX + 1];
+    int  a_length;
+    int  b_length;
+    const char* a_chars = string_value_chars(a, a_buffer, &a_length);
+    const char* b_chars = string_value_chars(b, b_buffer, &b_length);
+    return a_length == b_length && memcmp(a_chars, b_chars, a_length) == 0;
+}
+
 Obj_Upvalue* upvalue_new(Value* slot) {
     Obj_Upvalue* upvalue = _ALLOCATE_OBJ(Obj_Upvalue, OBJ_UPVALUE);
     upvalue->location    = slot;
     upvalue->closed      = V_NIL;
-    upvalue->next        = NULL;
+    upvalue->next        = obj_ref(NULL);
     return upvalue;
 }
 
@@ -84,21 +174,26 @@ Obj_Function* function_new(void) {
     function->arity         = 0;
     function->upvalue_count = 0;
     function->name          = NULL;
+    function->guard_epoch   = 0;
+    function->call_count    = 0;
+    function->jit           = NULL;
+    function->loops         = NULL;
+    function->loop_count    = 0;
+    function->loop_cap      = 0;
+    function->loop_last     = 0;
     chunk_init(&function->chunk);
     return function;
 }
 
 Obj_Closure* closure_new(Obj_Function* function) {
-    Obj_Upvalue** upvalues = ALLOCATE(Obj_Upvalue*, function->upvalue_count);
+    Obj_Closure* closure   = (Obj_Closure*) _object_allocate(CLOSURE_SIZE(function->upvalue_count), OBJ_CLOSURE);
+    closure->function      = obj_ref(function);
+    closure->upvalue_count = function->upvalue_count;
 
     for(int i = 0; i < function->upvalue_count; i += 1) {
-        upvalues[i] = NULL;
+        closure->upvalues[i] = obj_ref(NULL);
     }
 
-    Obj_Closure* closure   = _ALLOCATE_OBJ(Obj_Closure, OBJ_CLOSURE);
-    closure->function      = function;
-    closure->upvalues      = upvalues;
-    closure->upvalue_count = function->upvalue_count;
     return closure;
 }
 
@@ -109,39 +204,77 @@ Obj_Native* native_new(Native_Fn function) {
 }
 
 Obj_Class* class_new(Obj_String* name) {
-    Obj_Class* new_class = _ALLOCATE_OBJ(Obj_Class, OBJ_CLASS);
-    new_class->name     = name;
-    table_init(&new_class->methods);
+    Obj_Class* new_class    = _ALLOCATE_OBJ(Obj_Class, OBJ_CLASS);
+    new_class->name         = obj_ref(name);
+    new_class->methods      = NULL;
+    new_class->method_count = 0;
+    new_class->initializer  = obj_ref(NULL);
     return new_class;
 }
 
+// The class and the method must be reachable, growing the array may collect.
+void class_method_set(Obj_Class* class, int selector, Obj_Closure* method) {
+    if (selector >= class->method_count) {
+        int old_count       = class->method_count;
+        class->methods      = GROW_ARRAY(Obj_Ref, class->methods, old_count, selector + 1);
+        class->method_count = selector + 1;
+        for (int i = old_count; i < class->method_count; i += 1) {
+            class->methods[i] = obj_ref(NULL);
+        }
+    }
+
+    class->methods[selector] = obj_ref(method);
+}
+
 Obj_Instance* instance_new(Obj_Class* class) {
     Obj_Instance* instance = _ALLOCATE_OBJ(Obj_Instance, OBJ_INSTANCE);
-    instance->class        = class;
+    instance->class        = obj_ref(class);
     table_init(&instance->fields);
+    instance->bound_methods = NULL;
     return instance;
 }
 
 Obj_Bound_Method* bound_method_new(Value receiver, Obj_Closure* method) {
     Obj_Bound_Method* bound = _ALLOCATE_OBJ(Obj_Bound_Method, OBJ_BOUND_METHOD);
     bound->receiver         = receiver;
-    bound->method           = method;
+    bound->method           = obj_ref(method);
 
     return bound;
 }
 
+// `items` must be reachable, usually on the stack.
+Obj_List* list_new(Value* items, int count) {
+    Value* values = ALLOCATE(Value, count);
+    for (int i = 0; i < count; i += 1) {
+        values[i] = items[i];
+    }
+
+    Obj_List* list     = _ALLOCATE_OBJ(Obj_List, OBJ_LIST);
+    list->items.cap    = count;
+    list->items.len    = count;
+    list->items.values = values;
+    return list;
+}
+
+Obj_Map* map_new(void) {
+    Obj_Map* map = _ALLOCATE_OBJ(Obj_Map, OBJ_MAP);
+    table_init(&map->table);
+    return map;
+}
+
 void object_print(Value value) {
     switch(OBJ_TYPE(value)) {
         case OBJ_BOUND_METHOD: {
-            _function_print(AS_BOUND_METHOD(value)->method->function);
+            Obj_Closure* method = obj_deref(AS_BOUND_METHOD(value)->method);
+            _function_print(obj_deref(method->function));
             break;
         }
         case OBJ_CLASS: {
-            printf("%s", AS_CLASS(value)->name->chars);
+            printf("%s", ((Obj_String*) obj_deref(AS_CLASS(value)->name))->chars);
             break;
         }
         case OBJ_CLOSURE: {
-            _function_print(AS_CLOSURE(value)->function);
+            _function_print(obj_deref(AS_CLOSURE(value)->function));
             break;
         }
         case OBJ_FUNCTION: {
@@ -149,13 +282,60 @@ void object_print(Value value) {
             break;
         }
         case OBJ_INSTANCE: {
-            printf("%s instance", AS_INSTANCE(value)->class->name->chars);
+            Obj_Class* class = obj_deref(AS_INSTANCE(value)->class);
+            printf("%s instance", ((Obj_String*) obj_deref(class->name))->chars);
+            break;
+        }
+        case OBJ_LIST: {
+            Obj_List* list = AS_LIST(value);
+            if (!_print_enter((Obj*) list)) {
+                printf("[...]");
+                break;
+            }
+
+            printf("[");
+            for (int i = 0; i < list->items.len; i += 1) {
+                if (i > 0) printf(", ");
+                value_print(list->items.values[i]);
+            }
+            printf("]");
+            _printing_count -= 1;
+            break;
+        }
+        case OBJ_MAP: {
+            Table* table  = &AS_MAP(value)->table;
+            bool is_first = true;
+            if (!_print_enter((Obj*) AS_MAP(value))) {
+                printf("{...}");
+                break;
+            }
+
+            printf("{");
+            for (int i = 0; i < table->cap; i += 1) {
+                Table_Entry* entry = &table->entries[i];
+                if (IS_NIL(entry->key)) continue;
+
+                if (!is_first) printf(", ");
+                is_first = false;
+                value_print(entry->key);
+                printf(": ");
+                value_print(entry->value);
+            }
+            printf("}");
+            _printing_count -= 1;
             break;
         }
         case OBJ_NATIVE: {
             printf("<native fn>");
             break;
         }
+        case OBJ_SLICE: {
+            char buffer[SHORT_STRING_MAX + 1];
+            int  length;
+            const char* chars = string_value_chars(value, buffer, &length);
+            printf("%.*s", length, chars);
+            break;
+        }
         case OBJ_STRING: {
             printf("%s", AS_CSTRING(value));
             break;
@@ -167,6 +347,17 @@ void object_print(Value value) {
     }
 }
 
+// False when the container is already being printed, which would recurse forever, or when nested too deep.
+static bool _print_enter(Obj* object) {
+    if (_printing_count == PRINT_DEPTH_MAX) return false;
+    for (int i = 0; i < _printing_count; i += 1) {
+        if (_printing[i] == object) return false;
+    }
+
+    _printing[_printing_count++] = object;
+    return true;
+}
+
 static void _function_print(Obj_Function* function) {
     if (function->name == NULL) {
         printf("<script>");
@@ -5,13 +5,16 @@
 #include "table.h"
 #include "value.h"
 
-#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+#define OBJ_TYPE(value) ((Obj_Type) AS_OBJ(value)->type)
 #define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD)
 #define IS_CLASS(value) is_obj_type(value, OBJ_CLASS)
 #define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value) is_obj_type(value, OBJ_INSTANCE)
+#define IS_LIST(value) is_obj_type(value, OBJ_LIST)
+#define IS_MAP(value) is_obj_type(value, OBJ_MAP)
 #define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
+#define IS_SLICE(value) is_obj_type(value, OBJ_SLICE)
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
 
 #define AS_BOUND_METHOD(value) ((Obj_Bound_Method*) AS_OBJ(value))
@@ -19,7 +22,10 @@
 #define AS_CLOSURE(value) ((Obj_Closure*) AS_OBJ(value))
 #define AS_FUNCTION(value) ((Obj_Function*) AS_OBJ(value))
 #define AS_INSTANCE(value) ((Obj_Instance*) AS_OBJ(value))
+#define AS_LIST(value) ((Obj_List*) AS_OBJ(value))
+#define AS_MAP(value) ((Obj_Map*) AS_OBJ(value))
 #define AS_NATIVE(value) (((Obj_Native*) AS_OBJ(value))->function)
+#define AS_SLICE(value) ((Obj_Slice*) AS_OBJ(value))
 #define AS_STRING(value) ((Obj_String*) AS_OBJ(value))
 #define AS_CSTRING(value) (((Obj_String*) AS_OBJ(value))->chars)
 
@@ -29,26 +35,77 @@ typedef enum Obj_Type {
     OBJ_CLOSURE,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
+    OBJ_LIST,
+    OBJ_MAP,
     OBJ_NATIVE,
+    OBJ_SLICE,
     OBJ_STRING,
     OBJ_UPVALUE,
 } Obj_Type;
 
+// Links between objects are refs. With compressed refs, objects are allocated in one reserved region and a ref is
+// the 32-bit offset of the object in it in 8-byte units, 0 for NULL, so a ref addresses 32GB. Otherwise it is a
+// plain pointer.
+#if defined(OPTIMIZE_COMPRESSED_REFS) && defined(__linux__) && UINTPTR_MAX == UINT64_MAX
+#define COMPRESSED_REFS
+#endif
+
+#define HEAP_ALIGN 8
+#define HEAP_SHIFT 3
+
+#ifdef COMPRESSED_REFS
+typedef uint32_t Obj_Ref;
+
+extern uint8_t* heap_base;
+
+static inline Obj_Ref obj_ref(void* object) {
+    return object == NULL ? 0 : (Obj_Ref) (((uint8_t*) object - heap_base) >> HEAP_SHIFT);
+}
+
+static inline void* obj_deref(Obj_Ref ref) {
+    return ref == 0 ? NULL : heap_base + ((size_t) ref << HEAP_SHIFT);
+}
+#else
+typedef Obj* Obj_Ref;
+
+static inline Obj_Ref obj_ref(void* object) {
+    return (Obj*) object;
+}
+
+static inline void* obj_deref(Obj_Ref ref) {
+    return ref;
+}
+#endif
+
+// With compressed refs the heap is enumerated by walking the region, so the header is only these bytes and
+// the fields after it start in its padding.
 struct Obj {
-    Obj_Type type;
-    bool     is_marked;
-    Obj*     next;
+    uint8_t type;       // Obj_Type
+    bool    is_marked;
+    #ifdef COMPRESSED_REFS
+    uint8_t size_class; // Size in HEAP_ALIGN units, set by mem_object_allocate.
+    #else
+    Obj_Ref next;       // Every allocated object is linked from `vm.objects`.
+    #endif
 };
 
 typedef struct Obj_Function {
-    Obj         obj;
-    int         arity;
-    int         upvalue_count;
-    Chunk       chunk;
-    Obj_String* name;
+    Obj              obj;
+    int              arity;
+    int              upvalue_count;
+    Chunk            chunk;
+    Obj_String*      name;
+    uint32_t         guard_epoch; // `vm.guard_epoch` when its global was last seen holding it, see OP_GUARD_GLOBAL.
+    int              call_count;
+    struct Jit_Code* jit;         // Compiled once called JIT_HOT_CALLS times, NULL until then or when not compilable.
+    struct Jit_Loop* loops;       // Loop headers reached by a back edge while interpreted.
+    int              loop_count;
+    int              loop_last;   // Index in loops of the last header reached, checked before searching.
+    int              loop_cap;
 } Obj_Function;
 
-typedef Value (*Native_Fn)(int arg_count, Value* args);
+// The result replaces the callee in `args[-1]`. Returns false once a runtime error has been reported.
+typedef bool (*Native_Fn)(int arg_count, Value* args);
 
 typedef struct Obj_Native {
     Obj       obj;
@@ -60,43 +117,80 @@ struct Obj_String {
     int      length;
     char*    chars;
     uint32_t hash;
+    bool     is_guarded; // Name of a global checked by OP_GUARD_GLOBAL.
+    int      selector;   // Index in Obj_Class.methods once used as a method name, -1 before.
 };
 
+// Refs come first in objects, so compressed ones fill the padding after the header.
+
 typedef struct Obj_Upvalue {
-    Obj    obj;
-    Value* location;
-    Value  closed;
-    struct Obj_Upvalue* next;
+    Obj     obj;
+    Obj_Ref next;     // Obj_Upvalue
+    Value*  location;
+    Value   closed;
 } Obj_Upvalue;
 
 typedef struct Obj_Closure {
-    Obj           obj;
-    Obj_Function* function;
-    Obj_Upvalue** upvalues;
-    int           upvalue_count;
+    Obj     obj;
+    Obj_Ref function;      // Obj_Function
+    int     upvalue_count;
+    Obj_Ref upvalues[];    // Obj_Upvalue, allocated with the closure.
 } Obj_Closure;
 
+#define CLOSURE_SIZE(upvalue_count) (sizeof(Obj_Closure) + sizeof(Obj_Ref) * (upvalue_count))
+
 typedef struct Obj_Class {
-    Obj         obj;
-    Obj_String* name;
-    Table       methods;
+    Obj      obj;
+    Obj_Ref  name;         // Obj_String
+    Obj_Ref  initializer;  // Obj_Closure of the `init` method, NULL when there is none.
+    Obj_Ref* methods;      // Obj_Closure indexed by selector, NULL for the names the class does not define.
+    int      method_count;
 } Obj_Class;
 
 typedef struct Obj_Instance {
     Obj        obj;
-    Obj_Class* class;
+    Obj_Ref    class; // Obj_Class
     Table      fields;
+    Table*     bound_methods; // Obj_Bound_Method already created for this receiver by method name, NULL until one is.
 } Obj_Instance;
 
+// Elements are stored contiguously, the array grows geometrically.
+typedef struct Obj_List {
+    Obj         obj;
+    Value_Array items;
+} Obj_List;
+
+typedef struct Obj_Map {
+    Obj   obj;
+    Table table;
+} Obj_Map;
+
 typedef struct Obj_Bound_Method {
-    Obj          obj;
-    Value        receiver;
-    Obj_Closure* method;
+    Obj     obj;
+    Obj_Ref method;   // Obj_Closure
+    Value   receiver;
 } Obj_Bound_Method;
 
+// Characters of a string shared without copying, made by the string natives. Only strings longer than
+// SHORT_STRING_MAX are sliced, and a slice is flattened into an interned string once used as a map key.
+typedef struct Obj_Slice {
+    Obj     obj;
+    Obj_Ref string; // Obj_String, never another slice.
+    int     start;
+    int     length;
+} Obj_Slice;
+
 Obj_String* string_copy(const char* chars, int length);
 Obj_String* string_take(char* chars, int length);
 
+// Strings as values are short when they fit and interned Obj_String otherwise. Names of globals, properties and
+// methods are always Obj_String.
+Value       string_value(const char* chars, int length);
+const char* string_value_chars(Value value, char* buffer, int* length);
+Value       string_concatenate(Value a, Value b);
+Value       string_slice(Value string, int start, int length);
+bool        string_equal(Value a, Value b);
+
 Obj_Upvalue* upvalue_new(Value* slot);
 
 Obj_Function* function_new(void);
@@ -106,16 +200,31 @@ Obj_Closure* closure_new(Obj_Function* function);
 Obj_Native* native_new(Native_Fn function);
 
 Obj_Class* class_new(Obj_String* name);
+void       class_method_set(Obj_Class* class, int selector, Obj_Closure* method);
 
 Obj_Instance* instance_new(Obj_Class* class);
 
 Obj_Bound_Method* bound_method_new(Value receiver, Obj_Closure* method);
 
+Obj_List* list_new(Value* items, int count);
+
+Obj_Map* map_new(void);
+
 void object_print(Value value);
 
 static inline bool is_obj_type(Value value, Obj_Type type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+// Short, sliced or not, IS_STRING alone is only true for an Obj_String.
+static inline bool is_string(Value value) {
+    return IS_SHORT_STRING(value) || IS_STRING(value) || IS_SLICE(value);
+}
+
+static inline Obj_Closure* class_method_get(Obj_Class* class, Obj_String* name) {
+    if (name->selector < 0 || name->selector >= class->method_count) return NULL;
+    return obj_deref(class->methods[name->selector]);
+}
+
 #define INTERP_OBJECT_H
 #endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "optimizer.h"
+
+// Peephole pass run over each function's chunk once it is fully compiled.
+// The code is decoded into a list of instructions, rewritten there, and then compacted back in place
+// with the jump offsets and the line table recomputed.
+
+typedef struct Instruction {
+    int     offset;    // Offset in the original code.
+    int     length;
+    uint8_t op;        // Possibly rewritten opcode.
+    int     target;    // Index of the instruction jumped to, -1 for non jump instructions.
+    bool    is_target;
+    bool    is_dead;
+} Instruction;
+
+static bool _is_jump(uint8_t op);
+static int  _next_live(Instruction* instructions, int count, int idx);
+static void _targets_mark(Instruction* instructions, int count);
+
+static bool _pass_thread_jumps(Instruction* instructions, int count);
+static bool _pass_fuse_not_jump(Instruction* instructions, int count);
+static bool _pass_fuse_store_pop(Instruction* instructions, int count);
+static bool _pass_remove_dead_code(Instruction* instructions, int count);
+
+static void _chunk_rewrite(Chunk* chunk, Instruction* instructions, int count);
+
+void chunk_optimize(Chunk* chunk, const char* name) {
+    if (chunk->len == 0) return;
+
+    // Decode, an unknown opcode leaves the chunk untouched.
+    int count = 0;
+    for (int offset = 0; offset < chunk->len; count += 1) {
+        int length = chunk_instruction_length(chunk, offset);
+        if (length == 0) return;
+        offset += length;
+    }
+
+    Instruction* instructions = ALLOCATE(Instruction, count);
+    int  original_len         = chunk->len;
+    int* index_of             = ALLOCATE(int, original_len + 1);
+
+    for (int i = 0, offset = 0; i < count; i += 1) {
+        Instruction* instruction = &instructions[i];
+        instruction->offset      = offset;
+        instruction->length      = chunk_instruction_length(chunk, offset);
+        instruction->op          = chunk->code[offset];
+        instruction->target      = -1;
+        instruction->is_target   = false;
+        instruction->is_dead     = false;
+        index_of[offset]         = i;
+        offset                  += instruction->length;
+    }
+    index_of[chunk->len] = count;
+
+    for (int i = 0; i < count; i += 1) {
+        Instruction* instruction = &instructions[i];
+        if (!_is_jump(instruction->op)) continue;
+
+        // The jump offset is always the last operand, relative to the end of the instruction.
+        int end       = instruction->offset + instruction->length;
+        uint8_t* code = &chunk->code[end - 2];
+        int jump      = (code[0] << 8) | code[1];
+        int sign      = instruction->op == OP_LOOP ? -1 : 1;
+        instruction->target = index_of[end + sign * jump];
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed  = _pass_thread_jumps(instructions, count);
+        _targets_mark(instructions, count);
+        changed |= _pass_fuse_not_jump(instructions, count);
+        changed |= _pass_fuse_store_pop(instructions, count);
+        changed |= _pass_remove_dead_code(instructions, count);
+    }
+
+    #ifdef DEBUG_LOG_OPTIMIZER
+    int live = 0;
+    for (int i = 0; i < count; i += 1) {
+        if (!instructions[i].is_dead) live += 1;
+    }
+    printf("== %s == %d -> %d instructions\n", name, count, live);
+    #else
+    (void) name;
+    #endif
+
+    _chunk_rewrite(chunk, instructions, count);
+
+    FREE_ARRAY(int, index_of, original_len + 1);
+    FREE_ARRAY(Instruction, instructions, count);
+}
+
+static bool _is_jump(uint8_t op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_LOOP || op == OP_GUARD_GLOBAL;
+}
+
+static int _next_live(Instruction* instructions, int count, int idx) {
+    for (idx += 1; idx < count && instructions[idx].is_dead; idx += 1);
+    return idx;
+}
+
+static void _targets_mark(Instruction* instructions, int count) {
+    for (int i = 0; i < count; i += 1) {
+        instructions[i].is_target = false;
+    }
+
+    for (int i = 0; i < count; i += 1) {
+        Instruction* instruction = &instructions[i];
+        if (instruction->is_dead || instruction->target == -1) continue;
+        if (instruction->target < count) instructions[instruction->target].is_target = true;
+    }
+}
+
+// A jump landing on an unconditional jump goes straight to the final destination.
+// Conditional jumps are forward only, OP_JUMP and OP_LOOP pick their direction when rewritten.
+static bool _pass_thread_jumps(Instruction* instructions, int count) {
+    bool changed = false;
+
+    for (int i = 0; i < count; i += 1) {
+        Instruction* instruction = &instructions[i];
+        if (instruction->is_dead || instruction->target == -1) continue;
+
+        // Bounded by count so a `while (true) {}` style cycle terminates.
+        for (int hops = 0; hops < count; hops += 1) {
+            if (instruction->target >= count) break;
+
+            Instruction* landing = &instructions[instruction->target];
+            if (landing->op != OP_JUMP && landing->op != OP_LOOP) break;
+            if (landing->target == instruction->target) break;
+
+            int destination = landing->target;
+            bool is_conditional = instruction->op != OP_JUMP && instruction->op != OP_LOOP;
+            if (is_conditional && destination <= i) break;
+
+            // Code only shrinks, so the distance in the original code is an upper bound.
+            int destination_offset = destination < count ? instructions[destination].offset : instructions[count - 1].offset + instructions[count - 1].length;
+            int distance           = destination_offset - (instruction->offset + instruction->length);
+            if (distance > UINT16_MAX || -distance > UINT16_MAX) break;
+
+            instruction->target = destination;
+            changed             = true;
+        }
+    }
+
+    return changed;
+}
+
+// `OP_NOT; OP_JUMP_IF_FALSE` becomes `OP_JUMP_IF_TRUE` when both successors only pop the condition.
+static bool _pass_fuse_not_jump(Instruction* instructions, int count) {
+    bool changed = false;
+
+    for (int i = 0; i < count; i += 1) {
+        Instruction* negate = &instructions[i];
+        if (negate->is_dead || negate->op != OP_NOT) continue;
+
+        int j = _next_live(instructions, count, i);
+        if (j >= count) continue;
+        Instruction* jump = &instructions[j];
+        if (jump->op != OP_JUMP_IF_FALSE || jump->is_target) continue;
+
+        int k = _next_live(instructions, count, j);
+        if (k >= count || instructions[k].op != OP_POP) continue;
+        if (jump->target >= count || instructions[jump->target].op != OP_POP) continue;
+
+        negate->is_dead = true;
+        jump->op        = OP_JUMP_IF_TRUE;
+        changed         = true;
+    }
+
+    return changed;
+}
+
+// A store used as a statement is followed by an OP_POP of the stored value, use the popping variant instead.
+static bool _pass_fuse_store_pop(Instruction* instructions, int count) {
+    bool changed = false;
+
+    for (int i = 0; i < count; i += 1) {
+        Instruction* store = &instructions[i];
+        if (store->is_dead) continue;
+
+        uint8_t fused;
+        switch(store->op) {
+            case OP_SET_LOCAL:        fused = OP_SET_LOCAL_POP; break;
+            case OP_SET_GLOBAL:       fused = OP_SET_GLOBAL_POP; break;
+            case OP_SET_UPVALUE:      fused = OP_SET_UPVALUE_POP; break;
+            case OP_SET_PARENT_LOCAL: fused = OP_SET_PARENT_LOCAL_POP; break;
+            case OP_SET_PROPERTY:     fused = OP_SET_PROPERTY_POP; break;
+            default: continue;
+        }
+
+        int j = _next_live(instructions, count, i);
+        if (j >= count) continue;
+        Instruction* pop = &instructions[j];
+        if (pop->op != OP_POP || pop->is_target) continue;
+
+        store->op    = fused;
+        pop->is_dead = true;
+        changed      = true;
+    }
+
+    return changed;
+}
+
+// Nothing after an unconditional transfer is reachable until the next jump target.
+// A jump to the very next instruction is removed as well.
+static bool _pass_remove_dead_code(Instruction* instructions, int count) {
+    bool changed = false;
+
+    for (int i = 0; i < count; i += 1) {
+        Instruction* instruction = &instructions[i];
+        if (instruction->is_dead) continue;
+
+        if (instruction->op == OP_JUMP && instruction->target == _next_live(instructions, count, i)) {
+            instruction->is_dead = true;
+            changed              = true;
+            continue;
+        }
+
+        if (instruction->op != OP_RETURN && instruction->op != OP_JUMP && instruction->op != OP_LOOP) continue;
+
+        for (int j = _next_live(instructions, count, i); j < count && !instructions[j].is_target; j = _next_live(instructions, count, j)) {
+            instructions[j].is_dead = true;
+            changed                 = true;
+        }
+    }
+
+    return changed;
+}
+
+static void _chunk_rewrite(Chunk* chunk, Instruction* instructions, int count) {
+    // New offsets are never past the old ones, so the code can be compacted front to back in place.
+    int* new_offset = ALLOCATE(int, count + 1);
+    int  len        = 0;
+    for (int i = 0; i < count; i += 1) {
+        new_offset[i] = len;
+        if (!instructions[i].is_dead) len += instructions[i].length;
+    }
+    new_offset[count] = len;
+
+    for (int i = 0; i < count; i += 1) {
+        Instruction* instruction = &instructions[i];
+        if (instruction->is_dead) continue;
+
+        uint8_t* code = &chunk->code[new_offset[i]];
+        memmove(code, &chunk->code[instruction->offset], instruction->length);
+        memmove(&chunk->lines[new_offset[i]], &chunk->lines[instruction->offset], sizeof(int) * instruction->length);
+        code[0] = instruction->op;
+
+        if (instruction->target == -1) continue;
+
+        int jump = new_offset[instruction->target] - (new_offset[i] + instruction->length);
+        if (instruction->op == OP_JUMP || instruction->op == OP_LOOP) {
+            code[0] = jump < 0 ? OP_LOOP : OP_JUMP;
+            if (jump < 0) jump = -jump;
+        }
+        code[instruction->length - 2] = (jump >> 8) & 0xff;
+        code[instruction->length - 1] = jump & 0xff;
+    }
+
+    chunk->len = len;
+    FREE_ARRAY(int, new_offset, count + 1);
+}
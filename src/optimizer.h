@@ -0,0 +1,8 @@
+#ifndef INTERP_OPTIMIZER_H
+
+#include "chunk.h"
+
+void chunk_optimize(Chunk* chunk, const char* name);
+
+#define INTERP_OPTIMIZER_H
+#endif
@@ -24,18 +24,23 @@ static Scanner_Token _token_error(const char* msg);
 
 static Scanner_Token_Type _token_identifier_type(void);
 
+#define SCANNER_INTERPOLATION_MAX 8
+
 typedef struct Scanner {
     const char* start;
     const char* current;
     int         line;
+    int         interpolations;                    // Strings whose `${` expression is being scanned.
+    int         braces[SCANNER_INTERPOLATION_MAX]; // Braces opened in each of those expressions and not closed yet.
 } Scanner;
 
 Scanner scanner;
 
 void scanner_init(const char* source) {
-    scanner.start   = source;
-    scanner.current = source;
-    scanner.line    = 1;
+    scanner.start          = source;
+    scanner.current        = source;
+    scanner.line           = 1;
+    scanner.interpolations = 0;
 }
 
 Scanner_Token scanner_scan_token(void) {
@@ -51,10 +56,24 @@ Scanner_Token scanner_scan_token(void) {
     switch(c) {
         case '(': return _token_make(TOKEN_LEFT_PAREN);
         case ')': return _token_make(TOKEN_RIGHT_PAREN);
-        case '{': return _token_make(TOKEN_LEFT_BRACE);
-        case '}': return _token_make(TOKEN_RIGHT_BRACE);
+        case '{': {
+            if (scanner.interpolations > 0) scanner.braces[scanner.interpolations - 1] += 1;
+            return _token_make(TOKEN_LEFT_BRACE);
+        }
+        case '}': {
+            // Closing an interpolated expression, the string goes on.
+            if (scanner.interpolations > 0 && scanner.braces[scanner.interpolations - 1] == 0) {
+                scanner.interpolations -= 1;
+                return _token_make_string();
+            }
+            if (scanner.interpolations > 0) scanner.braces[scanner.interpolations - 1] -= 1;
+            return _token_make(TOKEN_RIGHT_BRACE);
+        }
+        case '[': return _token_make(TOKEN_LEFT_BRACKET);
+        case ']': return _token_make(TOKEN_RIGHT_BRACKET);
         case ';': return _token_make(TOKEN_SEMICOLON);
         case ',': return _token_make(TOKEN_COMMA);
+        case ':': return _token_make(TOKEN_COLON);
         case '.': return _token_make(TOKEN_DOT);
         case '-': return _token_make(TOKEN_MINUS);
         case '+': return _token_make(TOKEN_PLUS);
@@ -141,8 +160,25 @@ static Scanner_Token _token_make(Scanner_Token_Type type) {
     return token;
 }
 
+// Starts after the opening quote, or after the `}` closing an interpolated expression.
 static Scanner_Token _token_make_string(void) {
     while (_scanner_peek() != '"' && !_scanner_is_at_end()) {
+        // `\${` is a literal `${`, the compiler drops the backslash.
+        if (_scanner_peek() == '\\' && _scanner_peek_next() == '$' && scanner.current[2] == '{') {
+            scanner.current += 3;
+            continue;
+        }
+
+        if (_scanner_peek() == '$' && _scanner_peek_next() == '{') {
+            _scanner_advance();
+            _scanner_advance();
+            if (scanner.interpolations == SCANNER_INTERPOLATION_MAX) return _token_error("Interpolation nested too deeply.");
+
+            scanner.braces[scanner.interpolations] = 0;
+            scanner.interpolations                += 1;
+            return _token_make(TOKEN_INTERPOLATION);
+        }
+
         if (_scanner_peek() == '\n') scanner.line += 1;
         _scanner_advance();
     }
@@ -166,6 +202,16 @@ static Scanner_Token _token_make_number(void) {
         while(_is_digit(_scanner_peek())) _scanner_advance();
     }
 
+    // Look for an exponent, the same grammar number_parse reads. Without digits the `e` starts the next token.
+    if (_scanner_peek() == 'e' || _scanner_peek() == 'E') {
+        const char* digits = scanner.current + 1;
+        if (*digits == '+' || *digits == '-') digits += 1;
+        if (_is_digit(*digits)) {
+            scanner.current = digits;
+            while(_is_digit(_scanner_peek())) _scanner_advance();
+        }
+    }
+
     return _token_make(TOKEN_NUMBER);
 }
 
@@ -6,7 +6,10 @@ typedef enum Scanner_Token_Type {
     TOKEN_RIGHT_PAREN, 
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE, 
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA,
+    TOKEN_COLON,
     TOKEN_DOT,
     TOKEN_MINUS,
     TOKEN_PLUS,
@@ -27,6 +30,7 @@ typedef enum Scanner_Token_Type {
     // Literals
     TOKEN_IDENTIFIER,
     TOKEN_STRING,
+    TOKEN_INTERPOLATION, // A string up to `${`, its expression and the rest of the string follow.
     TOKEN_NUMBER,
 
     // Keywords
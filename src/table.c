@@ -6,151 +6,405 @@
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
-
-static Table_Entry* _entry_find(Table_Entry* entries, int cap, Obj_String* key);
-static void _table_adjust_cap(Table* table, int cap);
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Grows past 7/8 full, there are no tombstones to account for.
+#define TABLE_MAX_LOAD_NUM 7
+#define TABLE_MAX_LOAD_DEN 8
+
+#define CONTROL_EMPTY 0x80 // Full slots hold the low 7 bits of their key's hash, with the high bit clear.
+#define OVERFLOW_MAX  UINT8_MAX // Saturated counts are never decremented, the group stays probed past until a resize.
+
+#define HASH_TAG(hash)   ((uint8_t) ((hash) & 0x7f))
+#define HASH_GROUP(hash) ((hash) >> 7)
+
+// Keys are interned strings, normalized numbers, booleans or objects compared by identity.
+#ifdef NAN_BOXING
+#define KEYS_EQUAL(a, b) ((a) == (b))
+#else
+#define KEYS_EQUAL(a, b) value_equal(a, b)
+#endif
+
+static uint32_t _value_hash(Value key);
+static uint32_t _group_match(const uint8_t* control, uint8_t tag);
+static uint32_t _group_empty(const uint8_t* control);
+static uint8_t* _control_new(int cap);
+static void     _control_free(uint8_t* control, int cap);
+static int      _slot_claim(uint8_t* control, int cap, uint32_t hash);
+static void     _slot_release(uint8_t* control, int cap, uint32_t hash, int index);
+static bool     _is_over_load(int count, int cap);
+static int      _entry_find(Table* table, Value key, uint32_t hash);
+static bool     _entry_set(Table* table, Value key, uint32_t hash, Value value);
+static bool     _entry_delete(Table* table, Value key, uint32_t hash);
+static void     _table_adjust_cap(Table* table, int cap);
+static void     _string_set_adjust_cap(String_Set* set, int cap);
 
 void table_init(Table* table) {
     table->count   = 0;
     table->cap     = 0;
+    table->control = NULL;
     table->entries = NULL;
 }
 
 void table_free(Table* table) {
+    _control_free(table->control, table->cap);
     FREE_ARRAY(Table_Entry, table->entries, table->cap);
     table_init(table);
 }
 
 bool table_get(Table* table, Obj_String* key, Value* value) {
-    if (table->count == 0)  return false;
-
-    Table_Entry* entry = _entry_find(table->entries, table->cap, key);
-    if(entry == NULL) return false;
+    int index = _entry_find(table, V_OBJ(key), key->hash);
+    if (index == -1) return false;
 
-    *value = entry->value;
+    *value = table->entries[index].value;
     return true;
 }
 
-Obj_String* table_find_string(Table* table, const char* chars, int length, uint32_t hash) {
-    if (table->count == 0) return NULL;
+// Index of the key's entry, or -1, for callers caching where a key lives.
+int table_get_index(Table* table, Obj_String* key) {
+    return _entry_find(table, V_OBJ(key), key->hash);
+}
+
+bool table_set(Table* table, Obj_String* key, Value value) {
+    return _entry_set(table, V_OBJ(key), key->hash, value);
+}
 
-    uint32_t index = hash & (table->cap - 1); // fast modulo, because table capacity always a power of 2.
-    for (;;) {
-        Table_Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            // Stop if we find an empty non-tonbstone entry.
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0) {
-            // We found it
-            return entry->key;
+bool table_delete(Table* table, Obj_String* key) {
+    return _entry_delete(table, V_OBJ(key), key->hash);
+}
+
+void table_copy(Table* from, Table* to) {
+    for (int i = 0; i < from->cap; i += 1) {
+        Table_Entry* entry = &from->entries[i];
+        if (!IS_NIL(entry->key)) {
+            _entry_set(to, entry->key, _value_hash(entry->key), entry->value);
         }
+    }
+}
+
+bool table_get_value(Table* table, Value key, Value* value) {
+    int index = _entry_find(table, key, _value_hash(key));
+    if (index == -1) return false;
+
+    *value = table->entries[index].value;
+    return true;
+}
+
+bool table_set_value(Table* table, Value key, Value value) {
+    return _entry_set(table, key, _value_hash(key), value);
+}
+
+bool table_delete_value(Table* table, Value key) {
+    return _entry_delete(table, key, _value_hash(key));
+}
 
-        index = (index + 1) & (table->cap - 1);
+static uint32_t _value_hash(Value key) {
+    if (IS_STRING(key)) return AS_STRING(key)->hash; // Short strings hash by their bits.
+
+    #ifdef NAN_BOXING
+    uint64_t bits = key;
+    #else
+    uint64_t bits;
+    if (IS_OBJ(key)) {
+        bits = (uint64_t) (uintptr_t) AS_OBJ(key);
+    } else if (IS_BOOL(key)) {
+        bits = AS_BOOL(key);
+    } else {
+        double num = AS_NUMBER(key);
+        memcpy(&bits, &num, sizeof(double));
     }
+    #endif
 
+    // Small ints and pointers only differ in their low bits, they are mixed into all of the hash.
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t) bits;
 }
 
-bool table_set(Table* table, Obj_String* key, Value value) {
-    if (table->count + 1 > table->cap * TABLE_MAX_LOAD) {
-        int cap = GROW_CAPACITY(table->cap);
-        _table_adjust_cap(table, cap);
+// Bit i is set when the control byte of slot i in the group equals tag.
+static uint32_t _group_match(const uint8_t* control, uint8_t tag) {
+    #ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*) control);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+    #else
+    uint32_t match = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; i += 1) {
+        if (control[i] == tag) match |= 1u << i;
     }
+    return match;
+    #endif
+}
 
-    Table_Entry* entry = _entry_find(table->entries, table->cap, key);
-    bool is_new_key    = entry->key == NULL;
-    if (is_new_key && IS_NIL(entry->value)) table->count += 1;
+// Only empty control bytes have their high bit set.
+static uint32_t _group_empty(const uint8_t* control) {
+    #ifdef __SSE2__
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) control));
+    #else
+    return _group_match(control, CONTROL_EMPTY);
+    #endif
+}
 
-    entry->key   = key;
-    entry->value = value;
-    return is_new_key;
+// All groups empty, followed by zeroed overflow counts.
+static uint8_t* _control_new(int cap) {
+    uint8_t* control = ALLOCATE(uint8_t, cap + cap / TABLE_GROUP_SIZE);
+    memset(control, CONTROL_EMPTY, cap);
+    memset(control + cap, 0, cap / TABLE_GROUP_SIZE);
+    return control;
 }
 
-bool table_delete(Table* table, Obj_String* key) {
-    if (table->cap == 0) return false;
+static void _control_free(uint8_t* control, int cap) {
+    if (control == NULL) return; // A linear table.
+    FREE_ARRAY(uint8_t, control, cap + cap / TABLE_GROUP_SIZE);
+}
 
-    // Find the entry.
-    Table_Entry* entry = _entry_find(table->entries, table->cap, key);
-    if (entry == NULL) return false;
+// First empty slot on the hash's probe sequence, counting the key in the overflow of every full group it skips.
+static int _slot_claim(uint8_t* control, int cap, uint32_t hash) {
+    uint8_t* overflow = control + cap;
+    uint32_t groups   = (uint32_t) cap / TABLE_GROUP_SIZE;
+    uint32_t group    = HASH_GROUP(hash) & (groups - 1);
 
-    // Place a tombstone in the entry.
-    entry->key   = NULL;
-    entry->value = V_BOOL(true);
-    return true;
+    // The load factor keeps an empty slot somewhere.
+    for (uint32_t probe = 1;; probe += 1) {
+        uint32_t base  = group * TABLE_GROUP_SIZE;
+        uint32_t empty = _group_empty(&control[base]);
+        if (empty != 0) return (int) (base + __builtin_ctz(empty));
 
+        if (overflow[group] != OVERFLOW_MAX) overflow[group] += 1;
+        group = (group + probe) & (groups - 1);
+    }
 }
 
-void table_copy(Table* from, Table* to) {
-    for (int i = 0; i < from->cap; i += 1) {
-        Table_Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
-            table_set(to, entry->key, entry->value);
+// Empties the slot of a key with this hash, the groups it probed past no longer have to be.
+static void _slot_release(uint8_t* control, int cap, uint32_t hash, int index) {
+    control[index] = CONTROL_EMPTY;
 
-        }
+    uint8_t* overflow = control + cap;
+    uint32_t groups   = (uint32_t) cap / TABLE_GROUP_SIZE;
+    uint32_t group    = HASH_GROUP(hash) & (groups - 1);
+    for (uint32_t probe = 1; group != (uint32_t) index / TABLE_GROUP_SIZE; probe += 1) {
+        if (overflow[group] != OVERFLOW_MAX) overflow[group] -= 1;
+        group = (group + probe) & (groups - 1);
     }
 }
 
-static Table_Entry* _entry_find(Table_Entry* entries, int cap, Obj_String* key) {
-    uint32_t index         = key->hash & (cap - 1); // fast modulo, because table capacity always a power of 2.
-    Table_Entry* tombstone = NULL;
+static bool _is_over_load(int count, int cap) {
+    return count * TABLE_MAX_LOAD_DEN > cap * TABLE_MAX_LOAD_NUM;
+}
+
+static int _entry_find(Table* table, Value key, uint32_t hash) {
+    if (table->control == NULL) {
+        for (int i = 0; i < table->count; i += 1) {
+            if (KEYS_EQUAL(table->entries[i].key, key)) return i;
+        }
+        return -1;
+    }
 
-    for (;;) {
-        Table_Entry* entry = &entries[index];
+    uint8_t* overflow = table->control + table->cap;
+    uint32_t groups   = (uint32_t) table->cap / TABLE_GROUP_SIZE;
+    uint32_t group    = HASH_GROUP(hash) & (groups - 1);
 
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // We found a tombstone.
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            // We found the key
-            return entry;
+    for (uint32_t probe = 1; probe <= groups; probe += 1) {
+        uint32_t base = group * TABLE_GROUP_SIZE;
+        for (uint32_t match = _group_match(&table->control[base], HASH_TAG(hash)); match != 0; match &= match - 1) {
+            int index = (int) (base + __builtin_ctz(match));
+            if (KEYS_EQUAL(table->entries[index].key, key)) return index;
         }
+        // No key went past this group, so it would have been here.
+        if (overflow[group] == 0) return -1;
+
+        group = (group + probe) & (groups - 1);
+    }
+    return -1;
+}
+
+static bool _entry_set(Table* table, Value key, uint32_t hash, Value value) {
+    int index = _entry_find(table, key, hash);
+    if (index != -1) {
+        table->entries[index].value = value;
+        return false;
+    }
 
-        index = (index + 1) & (cap - 1);
+    bool is_full = table->control == NULL ? table->count == table->cap : _is_over_load(table->count + 1, table->cap);
+    if (is_full) _table_adjust_cap(table, table->cap == 0 ? TABLE_LINEAR_MIN : table->cap * 2);
+
+    if (table->control == NULL) {
+        index = table->count;
+    } else {
+        index = _slot_claim(table->control, table->cap, hash);
+        table->control[index] = HASH_TAG(hash);
     }
+    table->entries[index].key   = key;
+    table->entries[index].value = value;
+    table->count               += 1;
+    return true;
 }
 
+static bool _entry_delete(Table* table, Value key, uint32_t hash) {
+    int index = _entry_find(table, key, hash);
+    if (index == -1) return false;
+
+    table->count -= 1;
+    if (table->control == NULL) {
+        // The last entry fills the hole, so the live entries stay in front.
+        table->entries[index] = table->entries[table->count];
+        index                 = table->count;
+    } else {
+        _slot_release(table->control, table->cap, hash, index);
+    }
+    table->entries[index].key   = V_NIL;
+    table->entries[index].value = V_NIL;
+
+    if (table->cap > TABLE_LINEAR_MIN && table->count < table->cap / 4) _table_adjust_cap(table, table->cap / 2);
+    return true;
+}
+
+// Moves the entries into a linear table up to TABLE_LINEAR_MAX, a hashed one past it.
 static void _table_adjust_cap(Table* table, int cap) {
+    uint8_t* control     = cap > TABLE_LINEAR_MAX ? _control_new(cap) : NULL;
     Table_Entry* entries = ALLOCATE(Table_Entry, cap);
 
     for (int i = 0; i < cap; i += 1) {
-        entries[i].key = NULL;
+        entries[i].key   = V_NIL;
         entries[i].value = V_NIL;
     }
 
-    table->count = 0;
-    for (int i = 0; i < cap; i += 1) {
-        Table_Entry* entry = &entries[i];
-        if (entry->key == NULL) continue;
+    Table old = *table;
+    table->count   = 0;
+    table->cap     = cap;
+    table->control = control;
+    table->entries = entries;
 
-        Table_Entry* dest = _entry_find(entries, cap, entry->key);
-        dest->key     = entry->key;
-        dest->value   = entry->value;
-        table->count += 1;
+    for (int i = 0; i < old.cap; i += 1) {
+        Table_Entry* entry = &old.entries[i];
+        if (IS_NIL(entry->key)) continue;
+
+        int index = table->count;
+        if (control != NULL) {
+            uint32_t hash  = _value_hash(entry->key);
+            index          = _slot_claim(control, cap, hash);
+            control[index] = HASH_TAG(hash);
+        }
+        entries[index] = *entry;
+        table->count  += 1;
     }
 
-    FREE_ARRAY(Table_Entry, table->entries, table->cap);
-    table->entries = entries;
-    table->cap     = cap;
+    _control_free(old.control, old.cap);
+    FREE_ARRAY(Table_Entry, old.entries, old.cap);
 }
 
 void mark_table(Table* table) {
     for (int i = 0; i < table->cap; i += 1) {
         Table_Entry* entry = &table->entries[i];
-        mark_object((Obj*) entry->key);
+        mark_value(entry->key);
         mark_value(entry->value);
     }
 }
 
-void table_remove_white(Table* table) {
-    for (int i = 0; i < table->cap; i += 1) {
-        Table_Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.is_marked) {
-            table_delete(table, entry->key);
+void string_set_init(String_Set* set) {
+    set->count   = 0;
+    set->cap     = 0;
+    set->control = NULL;
+    set->hashes  = NULL;
+    set->strings = NULL;
+}
+
+void string_set_free(String_Set* set) {
+    _control_free(set->control, set->cap);
+    FREE_ARRAY(uint32_t, set->hashes, set->cap);
+    FREE_ARRAY(Obj_String*, set->strings, set->cap);
+    string_set_init(set);
+}
+
+Obj_String* string_set_find(String_Set* set, const char* chars, int length, uint32_t hash) {
+    if (set->count == 0) return NULL;
+
+    uint8_t* overflow = set->control + set->cap;
+    uint32_t groups   = (uint32_t) set->cap / TABLE_GROUP_SIZE;
+    uint32_t group    = HASH_GROUP(hash) & (groups - 1);
+
+    // Triangular steps visit every group once, since their count is a power of 2.
+    for (uint32_t probe = 1; probe <= groups; probe += 1) {
+        uint32_t base = group * TABLE_GROUP_SIZE;
+        for (uint32_t match = _group_match(&set->control[base], HASH_TAG(hash)); match != 0; match &= match - 1) {
+            uint32_t index = base + __builtin_ctz(match);
+            if (set->hashes[index] != hash) continue;
+
+            Obj_String* string = set->strings[index];
+            if (string->length == length && memcmp(string->chars, chars, length) == 0) return string;
         }
+        if (overflow[group] == 0) return NULL;
+
+        group = (group + probe) & (groups - 1);
     }
+    return NULL;
+}
+
+// The string must not be in the set already.
+void string_set_add(String_Set* set, Obj_String* string) {
+    if (_is_over_load(set->count + 1, set->cap)) {
+        _string_set_adjust_cap(set, set->cap == 0 ? TABLE_GROUP_SIZE : set->cap * 2);
+    }
+
+    int index = _slot_claim(set->control, set->cap, string->hash);
+    set->control[index] = HASH_TAG(string->hash);
+    set->hashes[index]  = string->hash;
+    set->strings[index] = string;
+    set->count         += 1;
+}
+
+// Called by the sweep for each string it frees, the set does not keep its strings alive.
+void string_set_delete(String_Set* set, Obj_String* string) {
+    if (set->count == 0) return;
+
+    uint8_t* overflow = set->control + set->cap;
+    uint32_t groups   = (uint32_t) set->cap / TABLE_GROUP_SIZE;
+    uint32_t group    = HASH_GROUP(string->hash) & (groups - 1);
+
+    for (uint32_t probe = 1; probe <= groups; probe += 1) {
+        uint32_t base = group * TABLE_GROUP_SIZE;
+        for (uint32_t match = _group_match(&set->control[base], HASH_TAG(string->hash)); match != 0; match &= match - 1) {
+            int index = (int) (base + __builtin_ctz(match));
+            if (set->strings[index] != string) continue;
+
+            set->strings[index] = NULL;
+            set->count         -= 1;
+            _slot_release(set->control, set->cap, string->hash, index);
+            return;
+        }
+        if (overflow[group] == 0) return;
+
+        group = (group + probe) & (groups - 1);
+    }
+}
+
+static void _string_set_adjust_cap(String_Set* set, int cap) {
+    uint8_t* control     = _control_new(cap);
+    uint32_t* hashes     = ALLOCATE(uint32_t, cap);
+    Obj_String** strings = ALLOCATE(Obj_String*, cap);
+
+    // Collecting while allocating may have deleted from the old arrays, they are only read from here on.
+    String_Set old = *set;
+    set->count     = 0;
+    set->cap       = cap;
+    set->control   = control;
+    set->hashes    = hashes;
+    set->strings   = strings;
+
+    for (int i = 0; i < old.cap; i += 1) {
+        if (old.control[i] == CONTROL_EMPTY) continue;
+
+        uint32_t hash  = old.hashes[i];
+        int index      = _slot_claim(control, cap, hash);
+        control[index] = HASH_TAG(hash);
+        hashes[index]  = hash;
+        strings[index] = old.strings[i];
+        set->count    += 1;
+    }
+
+    _control_free(old.control, old.cap);
+    FREE_ARRAY(uint32_t, old.hashes, old.cap);
+    FREE_ARRAY(Obj_String*, old.strings, old.cap);
 }
@@ -4,27 +4,58 @@
 #include "common.h"
 #include "value.h"
 
+#define TABLE_GROUP_SIZE 16 // Slots whose control bytes are probed at once.
+#define TABLE_LINEAR_MIN 4
+#define TABLE_LINEAR_MAX 8  // Tables up to this capacity have no control bytes and are searched front to back.
+
+// A nil key marks a free entry.
 typedef struct Table_Entry {
-    Obj_String* key;
-    Value       value;
+    Value key;
+    Value value;
 } Table_Entry;
 
+// Small tables keep their keys packed at the front of the entries and compare them one by one.
+// Larger ones use open addressing over groups of slots. Each slot has a control byte, empty or 7 bits of its key's
+// hash, and each group counts the keys that probed past it while it was full, so deleting never leaves a tombstone.
+// Tables shrink back once a quarter full.
 typedef struct Table {
     int          count;
-    int          cap;
+    int          cap;     // 0, or a power of 2 from TABLE_LINEAR_MIN.
+    uint8_t*     control; // NULL for linear tables, else cap control bytes followed by the overflow count of each group.
     Table_Entry* entries;
 } Table;
 
 void table_init(Table* table);
 void table_free(Table* table);
 bool table_get(Table* table, Obj_String* key, Value* value);
-Obj_String* table_find_string(Table* table, const char* chars, int length, uint32_t hash);
+int table_get_index(Table* table, Obj_String* key);
 bool table_set(Table* table, Obj_String* key, Value value);
 bool table_delete(Table* table, Obj_String* key);
 void table_copy(Table* from, Table* to);
 
+// Keyed by any value but nil. Numbers must be normalized so equal numbers have the same representation.
+bool table_get_value(Table* table, Value key, Value* value);
+bool table_set_value(Table* table, Value key, Value value);
+bool table_delete_value(Table* table, Value key);
+
 void mark_table(Table* table);
-void table_remove_white(Table* table);
+
+// Interned strings by their characters, with the same layout as Table but only the strings and their hashes in the
+// slots, so probing never reads a string that does not match. It holds them weakly, the sweep deletes each string it
+// frees.
+typedef struct String_Set {
+    int          count;
+    int          cap;
+    uint8_t*     control;
+    uint32_t*    hashes;
+    Obj_String** strings;
+} String_Set;
+
+void        string_set_init(String_Set* set);
+void        string_set_free(String_Set* set);
+Obj_String* string_set_find(String_Set* set, const char* chars, int length, uint32_t hash);
+void        string_set_add(String_Set* set, Obj_String* string);
+void        string_set_delete(String_Set* set, Obj_String* string);
 
 #define INTERP_TABLE_H
 #endif
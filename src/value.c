@@ -13,7 +13,8 @@ bool value_equal(Value a, Value b) {
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
 
-    return a == b;
+    if (a == b) return true;
+    return (IS_SLICE(a) || IS_SLICE(b)) && string_equal(a, b);
 
     #else
 
@@ -23,7 +24,7 @@ bool value_equal(Value a, Value b) {
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:    return true;
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b) || ((IS_SLICE(a) || IS_SLICE(b)) && string_equal(a, b));
         default: return false; // Unreachable.
     }
     
@@ -61,6 +62,10 @@ void value_print(Value value) {
         printf("nil");
     } else if (IS_NUMBER(value)) {
         printf("%g", AS_NUMBER(value));
+    } else if (IS_SHORT_STRING(value)) {
+        char chars[SHORT_STRING_MAX + 1];
+        short_string_chars(value, chars);
+        printf("%.*s", short_string_length(value), chars);
     } else if (IS_OBJ(value)) {
         object_print(value);
     }
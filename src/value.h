@@ -16,11 +16,25 @@ typedef struct Obj_String Obj_String;
 #define TAG_FALSE 2 // 10
 #define TAG_TRUE  3 // 11
 
+#define TAG_INT   ((uint64_t) 0x0001000000000000) // Above the 48 bits of an object pointer.
+#define TAG_SHORT ((uint64_t) 0x0002000000000000)
+
 typedef uint64_t Value;
 
-#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+// Small ints are numbers that skip the floating point unit, they print and compare as their double.
+#define IS_INT(value) (((value) & (QNAN | TAG_INT)) == (QNAN | TAG_INT))
+#define IS_INTS(a, b) (((a) & (b) & (QNAN | TAG_INT)) == (QNAN | TAG_INT))
+#define AS_INT(value) ((int32_t) (uint32_t) (value))
+#define V_INT(i)      ((Value) (QNAN | TAG_INT | (uint32_t) (i)))
+
+// Everything outside the quiet NaN space is a double, and inside it only ints carry TAG_INT.
+#define IS_NUMBER(value) (((value) & (QNAN | TAG_INT)) != QNAN)
+// Both operands of a binary operator at once, `&` keeps it to a single branch.
+#define IS_NUMBERS(a, b) (IS_NUMBER(a) & IS_NUMBER(b))
 #define AS_NUMBER(value) value_to_num(value)
 static inline double value_to_num(Value value) {
+    if (IS_INT(value)) return AS_INT(value);
+
     double num;
     memcpy(&num, &value, sizeof(Value));
     return num;
@@ -32,6 +46,14 @@ static inline Value num_to_value(double num) {
     return value;
 }
 
+// num as a small int when it is one. -0 stays a double, its sign shows once divided by.
+static inline Value number_value(double num) {
+    if (num >= INT32_MIN && num <= INT32_MAX && num == (int32_t) num && num_to_value(num) != SIGN_BIT) {
+        return V_INT((int32_t) num);
+    }
+    return num_to_value(num);
+}
+
 #define IS_NIL(value)  ((value) == V_NIL)
 #define V_NIL ((Value) (uint64_t) (QNAN | TAG_NIL))
 
@@ -45,6 +67,33 @@ static inline Value num_to_value(double num) {
 #define AS_OBJ(value) ((Obj*) (uintptr_t) ((value) & ~(SIGN_BIT | QNAN)))
 #define V_OBJ(obj)    (Value) (SIGN_BIT | QNAN | (uint64_t)(uintptr_t) (obj))
 
+// Strings of up to SHORT_STRING_MAX bytes live in the value itself, the first byte lowest and the length in bits 40
+// to 47. A string has one representation, so short strings compare and hash by their bits like everything else.
+#define SHORT_STRING_MAX 5
+
+#define IS_SHORT_STRING(value) (((value) & (SIGN_BIT | QNAN | TAG_INT | TAG_SHORT)) == (QNAN | TAG_SHORT))
+
+static inline int short_string_length(Value value) {
+    return (int) ((value >> 40) & 0xff);
+}
+
+// Writes the characters and a terminating NUL to `chars`, which holds SHORT_STRING_MAX + 1 bytes.
+static inline void short_string_chars(Value value, char* chars) {
+    int length = short_string_length(value);
+    for (int i = 0; i < length; i += 1) {
+        chars[i] = (char) (value >> (8 * i));
+    }
+    chars[length] = '\0';
+}
+
+static inline Value short_string_value(const char* chars, int length) {
+    Value value = QNAN | TAG_SHORT | ((uint64_t) length << 40);
+    for (int i = 0; i < length; i += 1) {
+        value |= (uint64_t) (uint8_t) chars[i] << (8 * i);
+    }
+    return value;
+}
+
 #else
 
 typedef enum Value_Type {
@@ -71,12 +120,27 @@ typedef struct Value {
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_NUMBERS(a, b) (IS_NUMBER(a) && IS_NUMBER(b))
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_OBJ(value) ((value).as.obj)
 #define AS_NUMBER(value) ((value).as.number)
 
+// Without NaN boxing there is no room for a separate int representation.
+#define IS_INT(value) false
+#define IS_INTS(a, b) false
+#define AS_INT(value) ((int32_t) AS_NUMBER(value))
+#define V_INT(i)      V_NUMBER(i)
+
+static inline Value number_value(double num) {
+    return V_NUMBER(num);
+}
+
+// Every string is an Obj_String.
+#define SHORT_STRING_MAX       0
+#define IS_SHORT_STRING(value) false
+
 #endif
 
 bool value_equal(Value a, Value b);
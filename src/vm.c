@@ -6,14 +6,26 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
 #include "memory.h"
+#include "number.h"
 #include "object.h"
 #include "vm.h"
 
+#define STRING_BUILD_NUMBER_MAX 24 // Room for any `%g` and short string.
+
 static void _vm_runtime_error(const char* format, ...);
 
 static bool _is_falsey(Value value);
 static void _concatenate(void);
+static void _list_build(int count);
+static bool _list_index(Value list, Value index, int* idx);
+static bool _map_build(int count);
+static bool _string_build(int count);
+static int  _int_format(int32_t num, char* chars);
+static bool _map_key(Value* key);
+static bool _index_get(void);
+static bool _index_set(void);
 
 static Interpret_Result _vm_run(void);
 
@@ -22,36 +34,79 @@ static void  _vm_stack_reset(void);
 
 static bool _call_value(Value callee, int arg_count);
 static bool _call(Obj_Closure* closure, int arg_count);
-
-static Value _native_clock(int arg_count, Value* args);
-static void  _native_define(const char* name, Native_Fn function);
+static void _bound_methods_new(Obj_Instance* instance);
+
+static bool _native_clock(int arg_count, Value* args);
+static bool _native_push(int arg_count, Value* args);
+static bool _native_pop(int arg_count, Value* args);
+static bool _native_len(int arg_count, Value* args);
+static bool _native_keys(int arg_count, Value* args);
+static bool _native_has(int arg_count, Value* args);
+static bool _native_remove(int arg_count, Value* args);
+static bool _native_substring(int arg_count, Value* args);
+static bool _native_split(int arg_count, Value* args);
+static bool _native_trim(int arg_count, Value* args);
+static bool _native_number(int arg_count, Value* args);
+static bool _native_arity(int arg_count, int arity);
+static bool _native_check(int arg_count, int arity, Value* args, Obj_Type type);
+static void _native_define(const char* name, Native_Fn function);
+
+#ifdef OPTIMIZE_QUICKEN
+static inline bool _quicken_count(Chunk* chunk, uint8_t* ip);
+#endif
+#ifdef DEBUG_LOG_QUICKEN
+static void _quicken_report(void);
+#endif
 
 VM vm;
 
 void vm_init(void) {
     _vm_stack_reset();
+    #ifndef COMPRESSED_REFS
     vm.objects         = NULL;
+    #endif
     vm.bytes_allocated = 0;
     vm.next_gc         = 1024 * 1024;
     vm.gray_count      = 0;
     vm.gray_capacity   = 0;
     vm.gray_stack      = NULL;
+    vm.bound_receiver_count = 0;
+    vm.bound_receiver_cap   = 0;
+    vm.bound_receivers      = NULL;
+    vm.guard_epoch     = 1;
     table_init(&vm.globals);
-    table_init(&vm.strings);
+    string_set_init(&vm.strings);
+    value_array_init(&vm.selectors);
+    mem_heap_init();
     vm.init_string = NULL;
     vm.init_string = string_copy("init", 4);
     _native_define("clock", _native_clock);
+    _native_define("push", _native_push);
+    _native_define("pop", _native_pop);
+    _native_define("len", _native_len);
+    _native_define("keys", _native_keys);
+    _native_define("has", _native_has);
+    _native_define("remove", _native_remove);
+    _native_define("substring", _native_substring);
+    _native_define("split", _native_split);
+    _native_define("trim", _native_trim);
+    _native_define("number", _native_number);
 }
 
 void vm_free(void) {
+    #ifdef DEBUG_LOG_QUICKEN
+    _quicken_report();
+    #endif
     table_free(&vm.globals);
-    table_free(&vm.strings);
+    string_set_free(&vm.strings);
+    value_array_free(&vm.selectors);
     vm.init_string = NULL;
     mem_free_objects();
+    mem_heap_free();
 }
 
-Interpret_Result vm_interpret(const char* source) {
-    Obj_Function* function = compiler_compile(source);
+Interpret_Result vm_interpret(const char* source, Compile_Mode mode) {
+    Obj_Function* function = compiler_compile(source, mode);
     if(function == NULL) return INTERPRET_COMPILE_ERROR;
 
     vm_stack_push(V_OBJ(function));
@@ -63,12 +118,16 @@ Interpret_Result vm_interpret(const char* source) {
     return _vm_run();
 }
 
+static Value* _upvalue_location(Obj_Closure* closure, int slot) {
+    return ((Obj_Upvalue*) obj_deref(closure->upvalues[slot]))->location;
+}
+
 static Obj_Upvalue* _upvalue_capture(Value* local) {
     Obj_Upvalue* prev_upvalue = NULL;
     Obj_Upvalue* upvalue      = vm.open_upvalues;
     while(upvalue != NULL && upvalue->location > local) {
         prev_upvalue = upvalue;
-        upvalue = upvalue->next;
+        upvalue      = obj_deref(upvalue->next);
     }
 
     if (upvalue != NULL && upvalue->location == local) {
@@ -76,12 +135,12 @@ static Obj_Upvalue* _upvalue_capture(Value* local) {
     }
     
     Obj_Upvalue* created_upvalue = upvalue_new(local);
-    created_upvalue->next = upvalue;
+    created_upvalue->next = obj_ref(upvalue);
 
     if(prev_upvalue == NULL) {
         vm.open_upvalues = created_upvalue;
     } else {
-        prev_upvalue->next = created_upvalue;
+        prev_upvalue->next = obj_ref(created_upvalue);
     }
 
     return created_upvalue;
@@ -92,38 +151,77 @@ static void _upvalue_close_from_slot_and_above(Value* last) {
         Obj_Upvalue* upvalue = vm.open_upvalues;
         upvalue->closed      = *upvalue->location;
         upvalue->location    = &upvalue->closed;
-        vm.open_upvalues     = upvalue->next;
+        vm.open_upvalues     = obj_deref(upvalue->next);
     }
 }
 
+static int _selector_of(Obj_String* name) {
+    if (name->selector == -1) {
+        name->selector = vm.selectors.len;
+        value_array_write(&vm.selectors, V_OBJ(name));
+    }
+    return name->selector;
+}
+
 static void _method_define(Obj_String* name) {
-    Value method = _vm_stack_peek(0);
-    Obj_Class* class = AS_CLASS(_vm_stack_peek(1));
-    table_set(&class->methods, name, method);
+    Obj_Closure* method = AS_CLOSURE(_vm_stack_peek(0));
+    Obj_Class* class    = AS_CLASS(_vm_stack_peek(1));
+    class_method_set(class, _selector_of(name), method);
+    if (name == vm.init_string) class->initializer = obj_ref(method);
     vm_stack_pop();
 }
 
+// The receiver on top of the stack is always an instance. Binding the same method to it again returns the cached
+// Obj_Bound_Method while it is reachable, so `a.m == a.m` holds like it does for a field. A `super` method with the
+// same name replaces it in the cache.
 static bool _method_bind(Obj_Class* class, Obj_String* name) {
-    Value method;
-    if (!table_get(&class->methods, name, &method)) {
+    Obj_Closure* method = class_method_get(class, name);
+    if (method == NULL) {
         _vm_runtime_error("Undefined property '%s'.", name->chars);
         return false;
     }
 
-    Obj_Bound_Method* bound = bound_method_new(_vm_stack_peek(0), AS_CLOSURE(method));
+    Obj_Instance* instance = AS_INSTANCE(_vm_stack_peek(0));
+    Value cached;
+    if (instance->bound_methods != NULL && table_get(instance->bound_methods, name, &cached) && !IS_NIL(cached)
+        && obj_deref(AS_BOUND_METHOD(cached)->method) == method) {
+        vm_stack_pop();
+        vm_stack_push(cached);
+        return true;
+    }
+
+    Obj_Bound_Method* bound = bound_method_new(_vm_stack_peek(0), method);
+    vm_stack_push(V_OBJ(bound));
+    if (instance->bound_methods == NULL) _bound_methods_new(instance);
+    table_set(instance->bound_methods, name, V_OBJ(bound));
+    vm_stack_pop();
     vm_stack_pop();
     vm_stack_push(V_OBJ(bound));
 
     return true;
 }
 
+// The cache is allocated on the first bound method, and listed for the collector to prune.
+static void _bound_methods_new(Obj_Instance* instance) {
+    Table* cache = ALLOCATE(Table, 1);
+    table_init(cache);
+    instance->bound_methods = cache;
+
+    if (vm.bound_receiver_cap < vm.bound_receiver_count + 1) {
+        vm.bound_receiver_cap = GROW_CAPACITY(vm.bound_receiver_cap);
+        vm.bound_receivers    = (Obj**) realloc(vm.bound_receivers, sizeof(Obj*) * vm.bound_receiver_cap);
+        if (vm.bound_receivers == NULL) exit(1);
+    }
+    vm.bound_receivers[vm.bound_receiver_count++] = (Obj*) instance;
+}
+
 static bool _invoke_from_class(Obj_Class* class, Obj_String* name, int arg_count) {
-    Value method;
-    if (!table_get(&class->methods, name, &method)) {
+    Obj_Closure* method = class_method_get(class, name);
+    if (method == NULL) {
         _vm_runtime_error("Undefined property '%s'.", name->chars);
         return false;
     }
-    return _call(AS_CLOSURE(method), arg_count);
+    return _call(method, arg_count);
 }
 
 static bool _invoke(Obj_String* name, int arg_count) {
@@ -142,29 +240,466 @@ static bool _invoke(Obj_String* name, int arg_count) {
         return _call_value(value, arg_count);
     }
 
-    return _invoke_from_class(instance->class, name, arg_count);
+    return _invoke_from_class(obj_deref(instance->class), name, arg_count);
+}
+
+#ifdef JIT_ENABLED
+// Runtime side of compiled code: one helper per instruction it does not run inline, each following its case in
+// `_vm_run`. The frame's ip is moved past the instruction first, so errors and calls see it as the interpreter would.
+
+static Call_Frame* _jit_frame(uint8_t* ip, int length) {
+    Call_Frame* frame = &vm.frames[vm.frame_count - 1];
+    frame->ip         = ip + length;
+    return frame;
+}
+
+static Value _jit_constant(Call_Frame* frame, uint8_t idx) {
+    return frame->function->chunk.constants.values[idx];
+}
+
+static Jit_Status _jit_get_global(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 2);
+    Obj_String* name  = AS_STRING(_jit_constant(frame, ip[1]));
+    Value value;
+    if (!table_get(&vm.globals, name, &value)) {
+        _vm_runtime_error("Undefined variable '%s'.", name->chars);
+        return JIT_ERROR;
+    }
+    vm_stack_push(value);
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_define_global(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 2);
+    Obj_String* name  = AS_STRING(_jit_constant(frame, ip[1]));
+    if (name->is_guarded) vm.guard_epoch += 1;
+    table_set(&vm.globals, name, _vm_stack_peek(0));
+    vm_stack_pop();
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_set_global(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 2);
+    Obj_String* name  = AS_STRING(_jit_constant(frame, ip[1]));
+    if (name->is_guarded) vm.guard_epoch += 1;
+    if (table_set(&vm.globals, name, _vm_stack_peek(0))) {
+        table_delete(&vm.globals, name);
+        _vm_runtime_error("Undefined variable '%s'.", name->chars);
+        return JIT_ERROR;
+    }
+    if (ip[0] == OP_SET_GLOBAL_POP) vm_stack_pop();
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_upvalue(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 2);
+    Value* location   = _upvalue_location(frame->closure, ip[1]);
+    switch (ip[0]) {
+        case OP_GET_UPVALUE:     vm_stack_push(*location); break;
+        case OP_SET_UPVALUE:     *location = _vm_stack_peek(0); break;
+        case OP_SET_UPVALUE_POP: *location = vm_stack_pop(); break;
+    }
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_parent_local(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 2);
+    Value* location   = &frame[-1].slots[ip[1]];
+    switch (ip[0]) {
+        case OP_GET_PARENT_LOCAL:     vm_stack_push(*location); break;
+        case OP_SET_PARENT_LOCAL:     *location = _vm_stack_peek(0); break;
+        case OP_SET_PARENT_LOCAL_POP: *location = vm_stack_pop(); break;
+    }
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_get_property(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 3);
+    if (!IS_INSTANCE(_vm_stack_peek(0))) {
+        _vm_runtime_error("Only instances have properties.");
+        return JIT_ERROR;
+    }
+
+    Obj_Instance* instance = AS_INSTANCE(_vm_stack_peek(0));
+    Obj_String* name       = AS_STRING(_jit_constant(frame, ip[1]));
+    Value value;
+    if (table_get(&instance->fields, name, &value)) {
+        *(vm.stack_top - 1) = value;
+        return JIT_CONTINUE;
+    }
+
+    return _method_bind(obj_deref(instance->class), name) ? JIT_CONTINUE : JIT_ERROR;
 }
 
+static Jit_Status _jit_set_property(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 2);
+    if (!IS_INSTANCE(_vm_stack_peek(1))) {
+        _vm_runtime_error("Only instances have fields.");
+        return JIT_ERROR;
+    }
+
+    Obj_Instance* instance = AS_INSTANCE(_vm_stack_peek(1));
+    table_set(&instance->fields, AS_STRING(_jit_constant(frame, ip[1])), _vm_stack_peek(0));
+    Value value = vm_stack_pop();
+    vm_stack_pop();
+    if (ip[0] == OP_SET_PROPERTY) vm_stack_push(value);
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_get_super(uint8_t* ip) {
+    Call_Frame* frame      = _jit_frame(ip, 2);
+    Obj_String* name       = AS_STRING(_jit_constant(frame, ip[1]));
+    Obj_Class* super_class = AS_CLASS(vm_stack_pop());
+    return _method_bind(super_class, name) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+static Jit_Status _jit_build_list(uint8_t* ip) {
+    _jit_frame(ip, 2);
+    _list_build(ip[1]);
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_build_map(uint8_t* ip) {
+    _jit_frame(ip, 2);
+    return _map_build(ip[1]) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+static Jit_Status _jit_build_string(uint8_t* ip) {
+    _jit_frame(ip, 2);
+    return _string_build(ip[1]) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+static Jit_Status _jit_index(uint8_t* ip) {
+    _jit_frame(ip, 1);
+    bool is_ok = ip[0] == OP_INDEX_GET ? _index_get() : _index_set();
+    return is_ok ? JIT_CONTINUE : JIT_ERROR;
+}
+
+static Jit_Status _jit_equal(uint8_t* ip) {
+    (void) ip;
+    Value a = vm_stack_pop();
+    Value b = vm_stack_pop();
+    vm_stack_push(V_BOOL(value_equal(a, b)));
+    return JIT_CONTINUE;
+}
+
+// Compiled code already handled two numbers.
+static Jit_Status _jit_arithmetic(uint8_t* ip) {
+    _jit_frame(ip, 1);
+    bool is_add = ip[0] == OP_ADD || ip[0] == OP_ADD_NUM || ip[0] == OP_ADD_STR;
+    if (is_add && is_string(_vm_stack_peek(0)) && is_string(_vm_stack_peek(1))) {
+        _concatenate();
+        return JIT_CONTINUE;
+    }
+
+    if (!IS_NUMBERS(_vm_stack_peek(0), _vm_stack_peek(1))) {
+        _vm_runtime_error(is_add ? "Operands must be two numbers or two strings." : "Operands must be numbers.");
+        return JIT_ERROR;
+    }
+
+    double b = AS_NUMBER(vm_stack_pop());
+    double a = AS_NUMBER(vm_stack_pop());
+    switch (ip[0]) {
+        case OP_GREATER:  vm_stack_push(V_BOOL(a > b)); break;
+        case OP_LESS:     vm_stack_push(V_BOOL(a < b)); break;
+        case OP_SUBTRACT: vm_stack_push(V_NUMBER(a - b)); break;
+        case OP_MULTIPLY: vm_stack_push(V_NUMBER(a * b)); break;
+        case OP_DIVIDE:   vm_stack_push(V_NUMBER(a / b)); break;
+        default:          vm_stack_push(V_NUMBER(a + b)); break;
+    }
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_unary(uint8_t* ip) {
+    _jit_frame(ip, 1);
+    if (ip[0] == OP_NOT) {
+        *(vm.stack_top - 1) = V_BOOL(_is_falsey(*(vm.stack_top - 1)));
+        return JIT_CONTINUE;
+    }
+
+    if (!IS_NUMBER(_vm_stack_peek(0))) {
+        _vm_runtime_error("Operand must be a number.");
+        return JIT_ERROR;
+    }
+    *(vm.stack_top - 1) = V_NUMBER(-AS_NUMBER(*(vm.stack_top - 1)));
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_print(uint8_t* ip) {
+    (void) ip;
+    value_print(vm_stack_pop());
+    printf("\n");
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_guard_global(uint8_t* ip) {
+    Call_Frame* frame      = _jit_frame(ip, 5);
+    Obj_String* name       = AS_STRING(_jit_constant(frame, ip[1]));
+    Obj_Function* function = AS_FUNCTION(_jit_constant(frame, ip[2]));
+    if (function->guard_epoch != vm.guard_epoch) {
+        Value value;
+        if (!table_get(&vm.globals, name, &value) || !IS_CLOSURE(value) || obj_deref(AS_CLOSURE(value)->function) != function) {
+            return JIT_BRANCH;
+        }
+        function->guard_epoch = vm.guard_epoch;
+    }
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_call(uint8_t* ip) {
+    _jit_frame(ip, 2);
+    int frame_count = vm.frame_count;
+    if (!_call_value(_vm_stack_peek(ip[1]), ip[1])) return JIT_ERROR;
+    return vm.frame_count == frame_count ? JIT_CONTINUE : JIT_CALL;
+}
+
+static Jit_Status _jit_invoke(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 3);
+    int frame_count   = vm.frame_count;
+    Obj_String* name  = AS_STRING(_jit_constant(frame, ip[1]));
+    if (ip[0] == OP_SUPER_INVOKE) {
+        Obj_Class* super_class = AS_CLASS(vm_stack_pop());
+        if (!_invoke_from_class(super_class, name, ip[2])) return JIT_ERROR;
+    } else {
+        if (!_invoke(name, ip[2])) return JIT_ERROR;
+    }
+    return vm.frame_count == frame_count ? JIT_CONTINUE : JIT_CALL;
+}
+
+static Jit_Status _jit_closure(uint8_t* ip) {
+    Call_Frame* frame      = &vm.frames[vm.frame_count - 1];
+    Obj_Function* function = AS_FUNCTION(_jit_constant(frame, ip[1]));
+    _jit_frame(ip, 2 + 2 * function->upvalue_count);
+
+    Obj_Closure* closure = closure_new(function);
+    vm_stack_push(V_OBJ(closure));
+    for (int i = 0; i < closure->upvalue_count; i += 1) {
+        uint8_t is_local = ip[2 + 2 * i];
+        uint8_t idx      = ip[3 + 2 * i];
+        if (is_local) {
+            closure->upvalues[i] = obj_ref(_upvalue_capture(frame->slots + idx));
+        } else {
+            closure->upvalues[i] = frame->closure->upvalues[idx];
+        }
+    }
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_close_upvalue(uint8_t* ip) {
+    (void) ip;
+    _upvalue_close_from_slot_and_above(vm.stack_top - 1);
+    vm_stack_pop();
+    return JIT_CONTINUE;
+}
+
+static Jit_Status _jit_return(uint8_t* ip) {
+    Call_Frame* frame = _jit_frame(ip, 1);
+    Value result      = vm_stack_pop();
+    _upvalue_close_from_slot_and_above(frame->slots);
+    vm.frame_count -= 1;
+
+    if (vm.frame_count == 0) {
+        vm_stack_pop();
+        return JIT_DONE;
+    }
+
+    vm.stack_top = frame->slots;
+    vm_stack_push(result);
+    return JIT_RETURN;
+}
+
+// Class declarations are left to the interpreter.
+static Jit_Helper _jit_helpers[UINT8_COUNT] = {
+    [OP_GET_GLOBAL]           = _jit_get_global,
+    [OP_DEFINE_GLOBAL]        = _jit_define_global,
+    [OP_SET_GLOBAL]           = _jit_set_global,
+    [OP_SET_GLOBAL_POP]       = _jit_set_global,
+    [OP_GET_UPVALUE]          = _jit_upvalue,
+    [OP_SET_UPVALUE]          = _jit_upvalue,
+    [OP_SET_UPVALUE_POP]      = _jit_upvalue,
+    [OP_GET_PARENT_LOCAL]     = _jit_parent_local,
+    [OP_SET_PARENT_LOCAL]     = _jit_parent_local,
+    [OP_SET_PARENT_LOCAL_POP] = _jit_parent_local,
+    [OP_GET_PROPERTY]         = _jit_get_property,
+    [OP_GET_FIELD_CACHED]     = _jit_get_property,
+    [OP_SET_PROPERTY]         = _jit_set_property,
+    [OP_SET_PROPERTY_POP]     = _jit_set_property,
+    [OP_GET_SUPER]            = _jit_get_super,
+    [OP_BUILD_LIST]           = _jit_build_list,
+    [OP_BUILD_MAP]            = _jit_build_map,
+    [OP_BUILD_STRING]         = _jit_build_string,
+    [OP_INDEX_GET]            = _jit_index,
+    [OP_INDEX_SET]            = _jit_index,
+    [OP_EQUAL]                = _jit_equal,
+    [OP_GREATER]              = _jit_arithmetic,
+    [OP_LESS]                 = _jit_arithmetic,
+    [OP_ADD]                  = _jit_arithmetic,
+    [OP_ADD_NUM]              = _jit_arithmetic,
+    [OP_ADD_STR]              = _jit_arithmetic,
+    [OP_SUBTRACT]             = _jit_arithmetic,
+    [OP_MULTIPLY]             = _jit_arithmetic,
+    [OP_DIVIDE]               = _jit_arithmetic,
+    [OP_NOT]                  = _jit_unary,
+    [OP_NEGATE]               = _jit_unary,
+    [OP_PRINT]                = _jit_print,
+    [OP_GUARD_GLOBAL]         = _jit_guard_global,
+    [OP_CALL]                 = _jit_call,
+    [OP_INVOKE]               = _jit_invoke,
+    [OP_SUPER_INVOKE]         = _jit_invoke,
+    [OP_CLOSURE]              = _jit_closure,
+    [OP_CLOSE_UPVALUE]        = _jit_close_upvalue,
+    [OP_RETURN]               = _jit_return,
+};
+
+// Counts the back edges to each loop header of interpreted code, and runs the loop's trace once there is one. The
+// trace leaves the frame at the instruction the interpreter resumes at. Loops that failed to record are left alone.
+static void _trace_loop(Call_Frame* frame) {
+    Obj_Function* function = frame->function;
+    int header             = (int) (frame->ip - function->chunk.code);
+
+    Jit_Loop* loop = function->loop_last < function->loop_count ? &function->loops[function->loop_last] : NULL;
+    if (loop == NULL || loop->header != header) {
+        loop = NULL;
+        for (int i = 0; i < function->loop_count && loop == NULL; i += 1) {
+            if (function->loops[i].header == header) loop = &function->loops[i];
+        }
+
+        if (loop == NULL) {
+            if (function->loop_count + 1 > function->loop_cap) {
+                int cap            = function->loop_cap;
+                function->loop_cap = GROW_CAPACITY(cap);
+                function->loops    = GROW_ARRAY(Jit_Loop, function->loops, cap, function->loop_cap);
+            }
+            loop              = &function->loops[function->loop_count++];
+            loop->header      = header;
+            loop->hotness     = 0;
+            loop->is_rejected = false;
+            loop->trace       = NULL;
+        }
+        function->loop_last = (int) (loop - function->loops);
+    }
+
+    if (loop->is_rejected) return;
+    if (loop->trace == NULL) {
+        loop->hotness += 1;
+        if (loop->hotness != TRACE_HOT_LOOPS) return;
+
+        int base          = (int) (vm.stack_top - frame->slots);
+        loop->trace       = jit_trace_record(&function->chunk, header, frame->slots, base, &vm.stack_top);
+        loop->is_rejected = loop->trace == NULL;
+        if (loop->is_rejected) return;
+    }
+
+    frame->ip = function->chunk.code + jit_trace_run(loop->trace, frame->slots);
+}
+
+// Runs frames while the top one is compiled. False once the script returned or failed, with its result.
+static bool _jit_run(Interpret_Result* result) {
+    for (;;) {
+        Call_Frame* frame      = &vm.frames[vm.frame_count - 1];
+        Obj_Function* function = frame->function;
+        if (function->jit == NULL) return true;
+
+        switch (jit_enter(function->jit, frame->slots, (int) (frame->ip - function->chunk.code))) {
+            case JIT_DONE: {
+                *result = INTERPRET_OK;
+                return false;
+            }
+            case JIT_ERROR: {
+                *result = INTERPRET_RUNTIME_ERROR;
+                return false;
+            }
+            default: break;
+        }
+    }
+}
+#endif
+
+#ifdef OPTIMIZE_QUICKEN
+// Each rewrite of an instruction after its first follows a deoptimization. Polymorphic instructions would otherwise
+// flip between their forms on every execution, so they are left generic once out of rewrites.
+static inline bool _quicken_count(Chunk* chunk, uint8_t* ip) {
+    if (chunk->rewrites == NULL) {
+        chunk->rewrites = ALLOCATE(uint8_t, chunk->cap);
+        memset(chunk->rewrites, 0, (size_t) chunk->cap);
+    }
+
+    uint8_t* rewrites = &chunk->rewrites[ip - chunk->code];
+    if (*rewrites == QUICKEN_REWRITES_MAX) return false;
+    *rewrites += 1;
+    return true;
+}
+#endif
+
 static Interpret_Result _vm_run(void) {
     Call_Frame* frame = &vm.frames[vm.frame_count - 1];
 
     // NOTE(AJA): Post increment is important here, because we return the current instruction pointer address,
     //            and then, and only then, we increment the instruction pointer address.
     #define READ_BYTE() (*frame->ip++)  
-    #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])  
+    #define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])  
     #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
     #define READ_STRING() (AS_STRING(READ_CONSTANT()))
-    #define BINARY_OP(value_type, op)                                          \
-    do {                                                                       \
-        if (!IS_NUMBER(_vm_stack_peek(0)) || !IS_NUMBER(_vm_stack_peek(1))) {  \
-            _vm_runtime_error("Operands must be numbers.");                    \
-            return INTERPRET_RUNTIME_ERROR;                                    \
-        }                                                                      \
-        double b = AS_NUMBER(vm_stack_pop());                                  \
-        double a = AS_NUMBER(vm_stack_pop());                                  \
-        vm_stack_push(value_type(a op b));                                     \
-    } while (false)                                                            \
-
+    // The current instruction rewrites itself into a form specialized for the operands it saw,
+    // which goes back to the generic form and re-executes it when its assumption fails. After QUICKEN_REWRITES_MAX
+    // rewrites it stays generic.
+    #ifdef OPTIMIZE_QUICKEN
+    #define QUICKEN(op, length)                                            \
+    do {                                                                   \
+        if (_quicken_count(&frame->function->chunk, frame->ip - (length))) \
+            frame->ip[-(length)] = (op);                                   \
+    } while (false)
+    #else
+    #define QUICKEN(op, length) ((void) 0)
+    #endif
+    #ifdef DEBUG_LOG_QUICKEN
+    #define QUICKEN_HIT()  (vm.quicken_hits[instruction] += 1)
+    #define QUICKEN_MISS() (vm.quicken_misses[instruction] += 1)
+    #else
+    #define QUICKEN_HIT()  ((void) 0)
+    #define QUICKEN_MISS() ((void) 0)
+    #endif
+    #define DEOPTIMIZE(op, length)     \
+    do {                               \
+        QUICKEN_MISS();                \
+        frame->ip   -= (length);       \
+        frame->ip[0] = (op);           \
+    } while (false)
+    // A frame whose function got compiled continues in compiled code from its current instruction.
+    #ifdef JIT_ENABLED
+    #define JIT_ENTER()                                    \
+    do {                                                   \
+        if (frame->function->jit != NULL) {                \
+            Interpret_Result jit_result;                   \
+            if (!_jit_run(&jit_result)) return jit_result; \
+            frame = &vm.frames[vm.frame_count - 1];        \
+        }                                                  \
+    } while (false)
+    #else
+    #define JIT_ENTER() ((void) 0)
+    #endif
+    // Works on the stack top in place, the result replaces the left operand.
+    #define BINARY_OP(value_type, op)                                       \
+    do {                                                                    \
+        Value b = vm.stack_top[-1];                                         \
+        Value a = vm.stack_top[-2];                                         \
+        if (!IS_NUMBERS(a, b)) {                                            \
+            _vm_runtime_error("Operands must be numbers.");                 \
+            return INTERPRET_RUNTIME_ERROR;                                 \
+        }                                                                   \
+        vm.stack_top    -= 1;                                               \
+        vm.stack_top[-1] = value_type(AS_NUMBER(a) op AS_NUMBER(b));        \
+    } while (false)
+    // int32 operands cannot overflow the int64 result, which goes back to a double out of the int32 range.
+    #define INT_OP(op)                                                      \
+    do {                                                                    \
+        int64_t x        = AS_INT(vm.stack_top[-2]);                        \
+        int64_t result   = x op AS_INT(vm.stack_top[-1]);                   \
+        vm.stack_top    -= 1;                                               \
+        vm.stack_top[-1] = result == (int32_t) result ? V_INT(result) : V_NUMBER(result); \
+    } while (false)
+
+    JIT_ENTER();
     for(;;) {
         #ifdef DEBUG_TRACE_EXECUTION
         printf(" ");
@@ -174,7 +709,7 @@ static Interpret_Result _vm_run(void) {
             printf(" ]");
         }
         printf("\n");
-        instruction_disassemble(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+        instruction_disassemble(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code));
         #endif
 
         uint8_t instruction;
@@ -217,6 +752,7 @@ static Interpret_Result _vm_run(void) {
             }
             case OP_DEFINE_GLOBAL: {
                 Obj_String* name = READ_STRING();
+                if (name->is_guarded) vm.guard_epoch += 1;
                 table_set(&vm.globals, name, _vm_stack_peek(0));
                 vm_stack_pop();
                 break;
@@ -226,8 +762,14 @@ static Interpret_Result _vm_run(void) {
                 frame->slots[slot] = _vm_stack_peek(0);
                 break;
             }
+            case OP_SET_LOCAL_POP: {
+                uint8_t slot = READ_BYTE();
+                frame->slots[slot] = vm_stack_pop();
+                break;
+            }
             case OP_SET_GLOBAL: {
                 Obj_String* name = READ_STRING();
+                if (name->is_guarded) vm.guard_epoch += 1;
                 if(table_set(&vm.globals, name, _vm_stack_peek(0))) {
                     table_delete(&vm.globals, name);
                     _vm_runtime_error("Undefined variable '%s'.", name->chars);
@@ -235,14 +777,45 @@ static Interpret_Result _vm_run(void) {
                 }
                 break;
             }
+            case OP_SET_GLOBAL_POP: {
+                Obj_String* name = READ_STRING();
+                if (name->is_guarded) vm.guard_epoch += 1;
+                if(table_set(&vm.globals, name, _vm_stack_peek(0))) {
+                    table_delete(&vm.globals, name);
+                    _vm_runtime_error("Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm_stack_pop();
+                break;
+            }
             case OP_GET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                vm_stack_push(*frame->closure->upvalues[slot]->location);
+                vm_stack_push(*_upvalue_location(frame->closure, slot));
                 break;
             }
             case OP_SET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = _vm_stack_peek(0);
+                *_upvalue_location(frame->closure, slot) = _vm_stack_peek(0);
+                break;
+            }
+            case OP_SET_UPVALUE_POP: {
+                uint8_t slot = READ_BYTE();
+                *_upvalue_location(frame->closure, slot) = vm_stack_pop();
+                break;
+            }
+            case OP_GET_PARENT_LOCAL: {
+                uint8_t slot = READ_BYTE();
+                vm_stack_push(frame[-1].slots[slot]);
+                break;
+            }
+            case OP_SET_PARENT_LOCAL: {
+                uint8_t slot = READ_BYTE();
+                frame[-1].slots[slot] = _vm_stack_peek(0);
+                break;
+            }
+            case OP_SET_PARENT_LOCAL_POP: {
+                uint8_t slot = READ_BYTE();
+                frame[-1].slots[slot] = vm_stack_pop();
                 break;
             }
             case OP_GET_PROPERTY: {
@@ -253,20 +826,43 @@ static Interpret_Result _vm_run(void) {
 
                 Obj_Instance* instance = AS_INSTANCE(_vm_stack_peek(0));
                 Obj_String* name = READ_STRING();
+                frame->ip += 1; // Field entry, only read once quickened.
 
-                Value value;
-                if (table_get(&instance->fields, name, &value)) {
+                int entry = table_get_index(&instance->fields, name);
+                if (entry != -1) {
+                    if (entry <= UINT8_MAX) {
+                        frame->ip[-1] = (uint8_t) entry;
+                        QUICKEN(OP_GET_FIELD_CACHED, 3);
+                    }
                     vm_stack_pop(); // Instance
-                    vm_stack_push(value);
+                    vm_stack_push(instance->fields.entries[entry].value);
                     break;
                 }
 
-                if(!_method_bind(instance->class, name)) {
+                if(!_method_bind(obj_deref(instance->class), name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 break;
             }
+            case OP_GET_FIELD_CACHED: {
+                // Instances filled in the same order share their fields layout, so the entry found last time is
+                // checked first.
+                Obj_String* name = READ_STRING();
+                uint8_t entry    = READ_BYTE();
+                Value receiver   = _vm_stack_peek(0);
+                if (IS_INSTANCE(receiver)) {
+                    Table* fields = &AS_INSTANCE(receiver)->fields;
+                    if (entry < fields->cap && AS_OBJ(fields->entries[entry].key) == (Obj*) name) {
+                        QUICKEN_HIT();
+                        *(vm.stack_top - 1) = fields->entries[entry].value;
+                        break;
+                    }
+                }
+
+                DEOPTIMIZE(OP_GET_PROPERTY, 3);
+                break;
+            }
             case OP_SET_PROPERTY: {
                 if (!IS_INSTANCE(_vm_stack_peek(1))) {
                     _vm_runtime_error("Only instances have fields.");
@@ -280,6 +876,17 @@ static Interpret_Result _vm_run(void) {
                 vm_stack_push(value);
                 break;
             }
+            case OP_SET_PROPERTY_POP: {
+                if (!IS_INSTANCE(_vm_stack_peek(1))) {
+                    _vm_runtime_error("Only instances have fields.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                Obj_Instance* instance = AS_INSTANCE(_vm_stack_peek(1));
+                table_set(&instance->fields, READ_STRING(), _vm_stack_peek(0));
+                vm.stack_top -= 2;
+                break;
+            }
             case OP_GET_SUPER: {
                 Obj_String* name = READ_STRING();
                 Obj_Class* super_class = AS_CLASS(vm_stack_pop());
@@ -290,27 +897,63 @@ static Interpret_Result _vm_run(void) {
 
                 break;
             }
+            case OP_BUILD_LIST: {
+                _list_build(READ_BYTE());
+                break;
+            }
+            case OP_BUILD_MAP: {
+                if (!_map_build(READ_BYTE())) return INTERPRET_RUNTIME_ERROR;
+                break;
+            }
+            case OP_BUILD_STRING: {
+                if (!_string_build(READ_BYTE())) return INTERPRET_RUNTIME_ERROR;
+                break;
+            }
+            case OP_INDEX_GET: {
+                if (!_index_get()) return INTERPRET_RUNTIME_ERROR;
+                break;
+            }
+            case OP_INDEX_SET: {
+                if (!_index_set()) return INTERPRET_RUNTIME_ERROR;
+                break;
+            }
             case OP_EQUAL: {
-                Value a = vm_stack_pop();
-                Value b = vm_stack_pop();
-                vm_stack_push(V_BOOL(value_equal(a ,b)));
+                Value b          = vm.stack_top[-1];
+                vm.stack_top    -= 1;
+                vm.stack_top[-1] = V_BOOL(value_equal(vm.stack_top[-1], b));
                 break;
             }
             case OP_GREATER: {
+                if (IS_INTS(vm.stack_top[-1], vm.stack_top[-2])) {
+                    vm.stack_top    -= 1;
+                    vm.stack_top[-1] = V_BOOL(AS_INT(vm.stack_top[-1]) > AS_INT(vm.stack_top[0]));
+                    break;
+                }
                 BINARY_OP(V_BOOL, >);
                 break;
             }
             case OP_LESS: {
+                if (IS_INTS(vm.stack_top[-1], vm.stack_top[-2])) {
+                    vm.stack_top    -= 1;
+                    vm.stack_top[-1] = V_BOOL(AS_INT(vm.stack_top[-1]) < AS_INT(vm.stack_top[0]));
+                    break;
+                }
                 BINARY_OP(V_BOOL, <);
                 break;
             }
             case OP_ADD: {
-                if(IS_STRING(_vm_stack_peek(0)) && IS_STRING(_vm_stack_peek(1))) {
+                Value b = vm.stack_top[-1];
+                Value a = vm.stack_top[-2];
+                if (IS_INTS(a, b)) {
+                    QUICKEN(OP_ADD_NUM, 1);
+                    INT_OP(+);
+                } else if (IS_NUMBERS(a, b)) {
+                    QUICKEN(OP_ADD_NUM, 1);
+                    vm.stack_top    -= 1;
+                    vm.stack_top[-1] = V_NUMBER(AS_NUMBER(a) + AS_NUMBER(b));
+                } else if(is_string(a) && is_string(b)) {
+                    QUICKEN(OP_ADD_STR, 1);
                     _concatenate();
-                } else if(IS_NUMBER(_vm_stack_peek(0)) && IS_NUMBER(_vm_stack_peek(1))) {
-                    double b = AS_NUMBER(vm_stack_pop());
-                    double a = AS_NUMBER(vm_stack_pop());
-                    vm_stack_push(V_NUMBER(a + b));
                 } else {
                     _vm_runtime_error("Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
@@ -318,7 +961,39 @@ static Interpret_Result _vm_run(void) {
 
                 break;
             }
+            case OP_ADD_NUM: {
+                Value b = vm.stack_top[-1];
+                Value a = vm.stack_top[-2];
+                if (IS_INTS(a, b)) {
+                    QUICKEN_HIT();
+                    INT_OP(+);
+                    break;
+                }
+                if (!IS_NUMBERS(a, b)) {
+                    DEOPTIMIZE(OP_ADD, 1);
+                    break;
+                }
+
+                QUICKEN_HIT();
+                vm.stack_top    -= 1;
+                vm.stack_top[-1] = V_NUMBER(AS_NUMBER(a) + AS_NUMBER(b));
+                break;
+            }
+            case OP_ADD_STR: {
+                if (!is_string(_vm_stack_peek(0)) || !is_string(_vm_stack_peek(1))) {
+                    DEOPTIMIZE(OP_ADD, 1);
+                    break;
+                }
+
+                QUICKEN_HIT();
+                _concatenate();
+                break;
+            }
             case OP_SUBTRACT: {
+                if (IS_INTS(vm.stack_top[-1], vm.stack_top[-2])) {
+                    INT_OP(-);
+                    break;
+                }
                 BINARY_OP(V_NUMBER, -);
                 break;
             }
@@ -360,9 +1035,33 @@ static Interpret_Result _vm_run(void) {
                 if(_is_falsey(_vm_stack_peek(0))) frame->ip += offset;
                 break;
             }
+            case OP_JUMP_IF_TRUE: {
+                uint16_t offset = READ_SHORT();
+                if(!_is_falsey(_vm_stack_peek(0))) frame->ip += offset;
+                break;
+            }
+            case OP_GUARD_GLOBAL: {
+                // Falls through to inlined code only while the global still holds the inlined function. The lookup is
+                // skipped until a guarded global is written again.
+                Obj_String* name       = READ_STRING();
+                Obj_Function* function = AS_FUNCTION(READ_CONSTANT());
+                uint16_t offset        = READ_SHORT();
+                if (function->guard_epoch != vm.guard_epoch) {
+                    Value value;
+                    if (!table_get(&vm.globals, name, &value) || !IS_CLOSURE(value) || obj_deref(AS_CLOSURE(value)->function) != function) {
+                        frame->ip += offset;
+                        break;
+                    }
+                    function->guard_epoch = vm.guard_epoch;
+                }
+                break;
+            }
             case OP_LOOP: {
                 uint16_t offset  = READ_SHORT();
                 frame->ip       -= offset;
+                #ifdef JIT_ENABLED
+                _trace_loop(frame);
+                #endif
                 break;
             }
             case OP_CALL: {
@@ -371,6 +1070,7 @@ static Interpret_Result _vm_run(void) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frame_count - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_INVOKE: {
@@ -380,6 +1080,7 @@ static Interpret_Result _vm_run(void) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frame_count - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_SUPER_INVOKE: {
@@ -392,6 +1093,7 @@ static Interpret_Result _vm_run(void) {
                 }
 
                 frame = &vm.frames[vm.frame_count - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_CLOSURE: {
@@ -402,7 +1104,7 @@ static Interpret_Result _vm_run(void) {
                     uint8_t is_local = READ_BYTE();
                     uint8_t idx      = READ_BYTE();
                     if(is_local) {
-                        closure->upvalues[i] = _upvalue_capture(frame->slots + idx);
+                        closure->upvalues[i] = obj_ref(_upvalue_capture(frame->slots + idx));
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[idx];
                     }
@@ -427,6 +1129,7 @@ static Interpret_Result _vm_run(void) {
                 vm.stack_top = frame->slots;
                 vm_stack_push(result);
                 frame = &vm.frames[vm.frame_count - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_CLASS: {
@@ -441,8 +1144,13 @@ static Interpret_Result _vm_run(void) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
+                // Copy down the superclass methods, the subclass ones are defined afterwards and override them.
+                Obj_Class* from      = AS_CLASS(super_class);
                 Obj_Class* sub_class = AS_CLASS(_vm_stack_peek(0));
-                table_copy(&AS_CLASS(super_class)->methods, &sub_class->methods);
+                for (int i = from->method_count - 1; i >= 0; i -= 1) {
+                    if (from->methods[i] != obj_ref(NULL)) class_method_set(sub_class, i, obj_deref(from->methods[i]));
+                }
+                sub_class->initializer = from->initializer;
                 vm_stack_pop();
                 break;
             }
@@ -458,26 +1166,215 @@ static Interpret_Result _vm_run(void) {
     #undef READ_SHORT
     #undef READ_CONSTANT
     #undef BINARY_OP
+    #undef INT_OP
+    #undef QUICKEN
+    #undef QUICKEN_HIT
+    #undef QUICKEN_MISS
+    #undef DEOPTIMIZE
+    #undef JIT_ENTER
 }
 
+#ifdef DEBUG_LOG_QUICKEN
+static void _quicken_report(void) {
+    static const struct { uint8_t op; const char* name; } specialized[] = {
+        {OP_ADD_NUM,          "OP_ADD_NUM"},
+        {OP_ADD_STR,          "OP_ADD_STR"},
+        {OP_GET_FIELD_CACHED, "OP_GET_FIELD_CACHED"},
+    };
+
+    printf("-- quicken\n");
+    for (size_t i = 0; i < sizeof(specialized) / sizeof(specialized[0]); i += 1) {
+        uint8_t op = specialized[i].op;
+        printf("%-20s %10llu hits %10llu misses\n", specialized[i].name,
+               (unsigned long long) vm.quicken_hits[op], (unsigned long long) vm.quicken_misses[op]);
+    }
+}
+#endif
+
 static bool _is_falsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
 static void _concatenate(void) {
-    Obj_String* b = AS_STRING(_vm_stack_peek(0));
-    Obj_String* a = AS_STRING(_vm_stack_peek(1));
-
-    int length  = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-    
-    Obj_String* result = string_take(chars, length);
-    vm_stack_pop();
-    vm_stack_pop();
-    vm_stack_push(V_OBJ(result));
+    Value result     = string_concatenate(_vm_stack_peek(1), _vm_stack_peek(0));
+    vm.stack_top    -= 1;
+    vm.stack_top[-1] = result;
+}
+
+// Replaces the `count` elements on top of the stack with a list of them.
+static void _list_build(int count) {
+    Obj_List* list = list_new(vm.stack_top - count, count);
+    vm.stack_top  -= count;
+    vm_stack_push(V_OBJ(list));
+}
+
+static bool _list_index(Value list, Value index, int* idx) {
+    if (!IS_LIST(list)) {
+        _vm_runtime_error("Only lists and maps can be indexed.");
+        return false;
+    }
+
+    if (!IS_NUMBER(index)) {
+        _vm_runtime_error("List index must be a number.");
+        return false;
+    }
+
+    double num = AS_NUMBER(index);
+    if (!(num >= 0 && num < AS_LIST(list)->items.len)) {
+        _vm_runtime_error("List index out of range.");
+        return false;
+    }
+
+    *idx = (int) num;
+    if (*idx != num) {
+        _vm_runtime_error("List index must be an integer.");
+        return false;
+    }
+    return true;
+}
+
+// Replaces the `count` keys and values on top of the stack with a map of them.
+static bool _map_build(int count) {
+    Obj_Map* map = map_new();
+    vm_stack_push(V_OBJ(map)); // Reachable while its table grows.
+
+    Value* entries = vm.stack_top - 1 - 2 * count;
+    for (int i = 0; i < count; i += 1) {
+        if (!_map_key(&entries[2 * i])) return false;
+        table_set_value(&map->table, entries[2 * i], entries[2 * i + 1]);
+    }
+
+    vm.stack_top -= 2 * count + 1;
+    vm_stack_push(V_OBJ(map));
+    return true;
+}
+
+// Ints with up to six digits, which `%g` prints in full, written without going through it.
+static int _int_format(int32_t num, char* chars) {
+    char digits[8];
+    int  count    = 0;
+    uint32_t rest = num < 0 ? (uint32_t) -num : (uint32_t) num;
+    do {
+        digits[count++] = (char) ('0' + rest % 10);
+        rest           /= 10;
+    } while (rest != 0);
+
+    int length = 0;
+    if (num < 0) chars[length++] = '-';
+    while (count > 0) chars[length++] = digits[--count];
+    return length;
+}
+
+// Replaces the `count` parts on top of the stack with the string joining them, numbers, booleans and nil printed
+// as `print` does. The result is sized once, and only it is interned.
+static bool _string_build(int count) {
+    Value*      parts = vm.stack_top - count;
+    const char* chars[UINT8_COUNT];
+    int         lengths[UINT8_COUNT];
+    char        buffers[UINT8_COUNT][STRING_BUILD_NUMBER_MAX]; // Numbers and short strings.
+
+    int length = 0;
+    for (int i = 0; i < count; i += 1) {
+        Value part = parts[i];
+        if (is_string(part)) {
+            chars[i] = string_value_chars(part, buffers[i], &lengths[i]);
+        } else if (IS_INT(part) && AS_INT(part) > -1000000 && AS_INT(part) < 1000000) {
+            chars[i]   = buffers[i];
+            lengths[i] = _int_format(AS_INT(part), buffers[i]);
+        } else if (IS_NUMBER(part)) {
+            chars[i]   = buffers[i];
+            lengths[i] = snprintf(buffers[i], STRING_BUILD_NUMBER_MAX, "%g", AS_NUMBER(part));
+        } else if (IS_BOOL(part) || IS_NIL(part)) {
+            chars[i]   = IS_NIL(part) ? "nil" : AS_BOOL(part) ? "true" : "false";
+            lengths[i] = (int) strlen(chars[i]);
+        } else {
+            _vm_runtime_error("Can only interpolate strings, numbers, booleans and nil.");
+            return false;
+        }
+        length += lengths[i];
+    }
+
+    // Parts stay on the stack while the result is allocated.
+    Value result;
+    if (length <= SHORT_STRING_MAX) {
+        char short_chars[SHORT_STRING_MAX + 1];
+        for (int i = 0, at = 0; i < count; at += lengths[i], i += 1) {
+            memcpy(short_chars + at, chars[i], lengths[i]);
+        }
+        result = string_value(short_chars, length);
+    } else {
+        char* heap_chars = ALLOCATE(char, length + 1);
+        for (int i = 0, at = 0; i < count; at += lengths[i], i += 1) {
+            memcpy(heap_chars + at, chars[i], lengths[i]);
+        }
+        heap_chars[length] = '\0';
+        result = V_OBJ(string_take(heap_chars, length));
+    }
+
+    vm.stack_top -= count;
+    vm_stack_push(result);
+    return true;
+}
+
+// Equal numbers must be the same key, ints and integral doubles get one representation and -0 becomes 0.
+// A slice becomes its interned string. The key is normalized in its stack slot, which keeps that string reachable.
+static bool _map_key(Value* key) {
+    if (IS_NIL(*key)) {
+        _vm_runtime_error("Map key can't be nil.");
+        return false;
+    }
+
+    if (IS_NUMBER(*key)) {
+        double num = AS_NUMBER(*key);
+        if (num != num) {
+            _vm_runtime_error("Map key can't be NaN.");
+            return false;
+        }
+        *key = number_value(num + 0.0);
+    } else if (IS_SLICE(*key)) {
+        char buffer[SHORT_STRING_MAX + 1];
+        int  length;
+        const char* chars = string_value_chars(*key, buffer, &length);
+        *key = V_OBJ(string_copy(chars, length));
+    }
+
+    return true;
+}
+
+// `list[index]` or `map[key]`, the element replaces both operands. A missing key reads as nil.
+static bool _index_get(void) {
+    Value container = _vm_stack_peek(1);
+    Value element;
+    if (IS_MAP(container)) {
+        if (!_map_key(&vm.stack_top[-1])) return false;
+        if (!table_get_value(&AS_MAP(container)->table, vm.stack_top[-1], &element)) element = V_NIL;
+    } else {
+        int idx;
+        if (!_list_index(container, _vm_stack_peek(0), &idx)) return false;
+        element = AS_LIST(container)->items.values[idx];
+    }
+
+    vm.stack_top    -= 1;
+    vm.stack_top[-1] = element;
+    return true;
+}
+
+// `list[index] = value` or `map[key] = value`, the value replaces all three operands.
+static bool _index_set(void) {
+    Value container = _vm_stack_peek(2);
+    Value value     = _vm_stack_peek(0);
+    if (IS_MAP(container)) {
+        if (!_map_key(&vm.stack_top[-2])) return false;
+        table_set_value(&AS_MAP(container)->table, vm.stack_top[-2], value);
+    } else {
+        int idx;
+        if (!_list_index(container, _vm_stack_peek(1), &idx)) return false;
+        AS_LIST(container)->items.values[idx] = value;
+    }
+
+    vm.stack_top    -= 2;
+    vm.stack_top[-1] = value;
+    return true;
 }
 
 static bool _call_value(Value callee, int arg_count) {
@@ -486,15 +1383,14 @@ static bool _call_value(Value callee, int arg_count) {
             case OBJ_BOUND_METHOD: {
                 Obj_Bound_Method* bound      = AS_BOUND_METHOD(callee);
                 vm.stack_top[-arg_count - 1] = bound->receiver;
-                return _call(bound->method, arg_count);
+                return _call(obj_deref(bound->method), arg_count);
             }
             case OBJ_CLASS: {
                 Obj_Class* class             = AS_CLASS(callee);
                 vm.stack_top[-arg_count - 1] = V_OBJ(instance_new(class));
 
-                Value initializer;
-                if (table_get(&class->methods, vm.init_string, &initializer)) {
-                    return _call(AS_CLOSURE(initializer), arg_count);
+                if (class->initializer != obj_ref(NULL)) {
+                    return _call(obj_deref(class->initializer), arg_count);
                 } else if (arg_count != 0) {
                     _vm_runtime_error("Expected 0 arguments but got %d.", arg_count);
                     return false;
@@ -504,10 +1400,9 @@ static bool _call_value(Value callee, int arg_count) {
             }
             case OBJ_CLOSURE: return _call(AS_CLOSURE(callee), arg_count);
             case OBJ_NATIVE: {
-                Native_Fn native  = AS_NATIVE(callee);
-                Value result      = native(arg_count, vm.stack_top - arg_count);
-                vm.stack_top     -= arg_count + 1;
-                vm_stack_push(result);
+                Native_Fn native = AS_NATIVE(callee);
+                if (!native(arg_count, vm.stack_top - arg_count)) return false;
+                vm.stack_top -= arg_count;
                 return true;
             }
             default: break; // Non-callable object type.
@@ -519,8 +1414,9 @@ static bool _call_value(Value callee, int arg_count) {
 }
 
 static bool _call(Obj_Closure* closure, int arg_count) {
-    if (arg_count != closure->function->arity) {
-        _vm_runtime_error("Expected %d arguments but got %d.", closure->function->arity, arg_count);
+    Obj_Function* function = obj_deref(closure->function);
+    if (arg_count != function->arity) {
+        _vm_runtime_error("Expected %d arguments but got %d.", function->arity, arg_count);
         return false;
     }
 
@@ -529,9 +1425,15 @@ static bool _call(Obj_Closure* closure, int arg_count) {
         return false;
     }
 
+    #ifdef JIT_ENABLED
+    function->call_count += 1;
+    if (function->call_count == JIT_HOT_CALLS) function->jit = jit_compile(&function->chunk, _jit_helpers, &vm.stack_top);
+    #endif
+
     Call_Frame* frame = &vm.frames[vm.frame_count++];
     frame->closure    = closure;
-    frame->ip         = closure->function->chunk.code;
+    frame->function   = function;
+    frame->ip         = function->chunk.code;
     frame->slots      = vm.stack_top - arg_count - 1;
     return true;
 }
@@ -564,10 +1466,209 @@ static void _native_define(const char* name, Native_Fn function) {
     vm_stack_pop();
 }
 
-static Value _native_clock(int arg_count, Value* args) {
+static bool _native_clock(int arg_count, Value* args) {
     (void) arg_count;
-    (void) args;
-    return V_NUMBER((double)clock() / CLOCKS_PER_SEC);
+    args[-1] = V_NUMBER((double)clock() / CLOCKS_PER_SEC);
+    return true;
+}
+
+// `push(list, value)` appends in amortized constant time.
+static bool _native_push(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 2, args, OBJ_LIST)) return false;
+    value_array_write(&AS_LIST(args[0])->items, args[1]);
+    args[-1] = V_NIL;
+    return true;
+}
+
+// `pop(list)` removes and returns the last element.
+static bool _native_pop(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 1, args, OBJ_LIST)) return false;
+
+    Value_Array* items = &AS_LIST(args[0])->items;
+    if (items->len == 0) {
+        _vm_runtime_error("Can't pop from an empty list.");
+        return false;
+    }
+    items->len -= 1;
+    args[-1]    = items->values[items->len];
+    return true;
+}
+
+static bool _native_len(int arg_count, Value* args) {
+    if (!_native_arity(arg_count, 1)) return false;
+
+    if (IS_LIST(args[0])) {
+        args[-1] = V_INT(AS_LIST(args[0])->items.len);
+    } else if (IS_MAP(args[0])) {
+        args[-1] = V_INT(AS_MAP(args[0])->table.count);
+    } else if (is_string(args[0])) {
+        char buffer[SHORT_STRING_MAX + 1];
+        int  length;
+        string_value_chars(args[0], buffer, &length);
+        args[-1] = V_INT(length);
+    } else {
+        _vm_runtime_error("Expected a list, a map or a string as first argument.");
+        return false;
+    }
+    return true;
+}
+
+// `keys(map)` lists the keys of a map, which is how scripts iterate over it.
+static bool _native_keys(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 1, args, OBJ_MAP)) return false;
+
+    // The list takes the callee's slot right away, appending to it may collect.
+    Obj_List* list = list_new(NULL, 0);
+    args[-1]       = V_OBJ(list);
+
+    Table* table = &AS_MAP(args[0])->table;
+    for (int i = 0; i < table->cap; i += 1) {
+        if (!IS_NIL(table->entries[i].key)) value_array_write(&list->items, table->entries[i].key);
+    }
+    return true;
+}
+
+static bool _native_has(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 2, args, OBJ_MAP)) return false;
+
+    Value value;
+    if (!_map_key(&args[1])) return false;
+    args[-1] = V_BOOL(table_get_value(&AS_MAP(args[0])->table, args[1], &value));
+    return true;
+}
+
+// `remove(map, key)` returns whether the key was there.
+static bool _native_remove(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 2, args, OBJ_MAP)) return false;
+
+    if (!_map_key(&args[1])) return false;
+    args[-1] = V_BOOL(table_delete_value(&AS_MAP(args[0])->table, args[1]));
+    return true;
+}
+
+// `substring(string, start, end)` shares the characters from start up to, not including, end.
+static bool _native_substring(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 3, args, OBJ_STRING)) return false;
+
+    char buffer[SHORT_STRING_MAX + 1];
+    int  length;
+    string_value_chars(args[0], buffer, &length);
+
+    if (!IS_NUMBER(args[1]) || !IS_NUMBER(args[2])) {
+        _vm_runtime_error("Substring bounds must be numbers.");
+        return false;
+    }
+
+    double start = AS_NUMBER(args[1]);
+    double end   = AS_NUMBER(args[2]);
+    if (!(start >= 0 && start <= end && end <= length)) {
+        _vm_runtime_error("Substring bounds out of range.");
+        return false;
+    }
+    if (start != (int) start || end != (int) end) {
+        _vm_runtime_error("Substring bounds must be integers.");
+        return false;
+    }
+
+    args[-1] = string_slice(args[0], (int) start, (int) (end - start));
+    return true;
+}
+
+// `split(string, separator)` lists the pieces between separators, each sharing the string's characters.
+static bool _native_split(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 2, args, OBJ_STRING)) return false;
+    if (!is_string(args[1])) {
+        _vm_runtime_error("Separator must be a string.");
+        return false;
+    }
+
+    char buffer[SHORT_STRING_MAX + 1];
+    char separator_buffer[SHORT_STRING_MAX + 1];
+    int  length;
+    int  separator_length;
+    const char* chars     = string_value_chars(args[0], buffer, &length);
+    const char* separator = string_value_chars(args[1], separator_buffer, &separator_length);
+    if (separator_length == 0) {
+        _vm_runtime_error("Separator can't be empty.");
+        return false;
+    }
+
+    // The list takes the callee's slot right away, and each piece is on the stack until appended.
+    Obj_List* list = list_new(NULL, 0);
+    args[-1]       = V_OBJ(list);
+
+    int start = 0;
+    for (int i = 0; i + separator_length <= length;) {
+        if (memcmp(chars + i, separator, separator_length) != 0) {
+            i += 1;
+            continue;
+        }
+
+        vm_stack_push(string_slice(args[0], start, i - start));
+        value_array_write(&list->items, _vm_stack_peek(0));
+        vm_stack_pop();
+        i    += separator_length;
+        start = i;
+    }
+
+    vm_stack_push(string_slice(args[0], start, length - start));
+    value_array_write(&list->items, _vm_stack_peek(0));
+    vm_stack_pop();
+    return true;
+}
+
+static bool _is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// `trim(string)` shares the characters between the leading and trailing whitespace.
+static bool _native_trim(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 1, args, OBJ_STRING)) return false;
+
+    char buffer[SHORT_STRING_MAX + 1];
+    int  length;
+    const char* chars = string_value_chars(args[0], buffer, &length);
+
+    int start = 0;
+    int end   = length;
+    while (start < end && _is_space(chars[start])) start += 1;
+    while (end > start && _is_space(chars[end - 1])) end -= 1;
+
+    args[-1] = string_slice(args[0], start, end - start);
+    return true;
+}
+
+// `number(string)` reads a numeric literal, or gives nil when the whole string isn't one.
+static bool _native_number(int arg_count, Value* args) {
+    if (!_native_check(arg_count, 1, args, OBJ_STRING)) return false;
+
+    char buffer[SHORT_STRING_MAX + 1];
+    int  length;
+    const char* chars = string_value_chars(args[0], buffer, &length);
+
+    double num;
+    args[-1] = number_parse(chars, length, &num) ? number_value(num) : V_NIL;
+    return true;
+}
+
+static bool _native_arity(int arg_count, int arity) {
+    if (arg_count != arity) {
+        _vm_runtime_error("Expected %d arguments but got %d.", arity, arg_count);
+        return false;
+    }
+    return true;
+}
+
+// Collection and string natives take the collection or string as their first argument, OBJ_STRING accepts any string.
+static bool _native_check(int arg_count, int arity, Value* args, Obj_Type type) {
+    if (!_native_arity(arg_count, arity)) return false;
+
+    bool is_type = type == OBJ_STRING ? is_string(args[0]) : is_obj_type(args[0], type);
+    if (!is_type) {
+        _vm_runtime_error("Expected a %s as first argument.", type == OBJ_LIST ? "list" : type == OBJ_MAP ? "map" : "string");
+        return false;
+    }
+    return true;
 }
 
 static void _vm_runtime_error(const char* format, ...) {
@@ -580,7 +1681,7 @@ static void _vm_runtime_error(const char* format, ...) {
 
     for (int i = vm.frame_count - 1; i >= 0; i -= 1) {
         Call_Frame* frame = &vm.frames[i];
-        Obj_Function* function = frame->closure->function;
+        Obj_Function* function = frame->function;
         size_t instruction = frame->ip - function->chunk.code - 1;
 
         fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
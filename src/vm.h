@@ -1,5 +1,6 @@
 #ifndef INTERP_VM_H
 
+#include "compiler.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
@@ -9,6 +10,7 @@
 
 typedef struct Call_Frame {
     Obj_Closure*  closure;
+    Obj_Function* function; // The closure's, followed once per call.
     uint8_t*      ip;
     Value*        slots;
 } Call_Frame;
@@ -19,15 +21,26 @@ typedef struct VM {
     Value        stack[STACK_MAX];
     Value*       stack_top;
     Table        globals;
-    Table        strings;
+    String_Set   strings;
     Obj_String*  init_string;
+    Value_Array  selectors; // Method names by selector, kept alive so a name always maps to the same selector.
     Obj_Upvalue* open_upvalues;
+    uint32_t     guard_epoch; // Bumped on each write to a guarded global.
+    #ifdef DEBUG_LOG_QUICKEN
+    uint64_t     quicken_hits[UINT8_COUNT];   // By specialized opcode.
+    uint64_t     quicken_misses[UINT8_COUNT];
+    #endif
     size_t       bytes_allocated;
     size_t       next_gc;
+    #ifndef COMPRESSED_REFS
     Obj*         objects;
+    #endif
     int          gray_count;
     int          gray_capacity;
     Obj**        gray_stack;
+    int          bound_receiver_count;
+    int          bound_receiver_cap;
+    Obj**        bound_receivers; // Obj_Instance with a bound method cache, which holds its methods weakly.
 } VM;
 
 typedef enum Interpret_Result {
@@ -41,7 +54,7 @@ extern VM vm;
 
 void vm_init(void);
 void vm_free(void);
-Interpret_Result vm_interpret(const char* source);
+Interpret_Result vm_interpret(const char* source, Compile_Mode mode);
 void vm_stack_push(Value value);
 Value vm_stack_pop(void);
 
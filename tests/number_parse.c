@@ -0,0 +1,159 @@
+// Checks number_parse against the C library's strtod, bit for bit, on fixed edge cases and a seeded random corpus.
+// Build and run from the repository root:
+//
+//     clang -O2 -Isrc tests/number_parse.c -o output/number_parse -lm && ./output/number_parse [random rounds]
+//
+// Exits with 1 after printing the first mismatches.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.c"
+
+#define CASE_LENGTH_MAX 512
+#define FAILURES_SHOWN  20
+
+static long     _case_count;
+static long     _failure_count;
+static uint64_t _seed = 88172645463325252u;
+
+static uint64_t _random(void);
+static void     _case_check(const char* chars);
+static void     _case_reject(const char* chars);
+static void     _midpoints_check(uint64_t mantissa, int shift);
+static void     _near_midpoints_check(double num);
+
+// Subnormal and overflow boundaries, numbers a double holds exactly and long mantissas that need the fallback.
+static const char* _edges[] = {
+    "0", "-0", "0.0", "0e0", "1", "-1", "1.5", "0.1", "0.3", "1e23", "8.98846567431158e307",
+    "9007199254740992", "9007199254740993", "9007199254740994", "9007199254740995",
+    "9223372036854775807", "9223372036854775808", "18446744073709551615", "18446744073709551616",
+    "4.9e-324", "5e-324", "4.9406564584124654e-324", "2.4703282292062327e-324", "2.4703282292062328e-324",
+    "2.2250738585072011e-308", "2.2250738585072012e-308", "2.2250738585072014e-308", "1e-320", "1e-400",
+    "1.7976931348623157e308", "1.7976931348623158e308", "1.7976931348623159e308", "1e308", "1e309", "1e400",
+    "0.000000000000000000000000000001", "123456789012345678901234567890", "3.14159265358979323846264338327950288",
+    "1.00000000000000011102230246251565404236316680908203124",
+    "1.00000000000000011102230246251565404236316680908203125",
+    "1.00000000000000011102230246251565404236316680908203126",
+    "7.2057594037927933e16", "1e-342", "1e-343", "1e-324", "1e308", "1e-22", "1e22", "9999999999999999999e-10",
+};
+
+static const char* _malformed[] = {
+    "", "-", "+1", "--1", ".", ".5", "1.", "-.5", "1e", "1e+", "1e-", "1.e5", "abc", "1x", " 1", "1 ", "1.2.3",
+    "1e5.5", "inf", "-inf", "nan", "0x10", "1_000", "1,5",
+};
+
+int main(int argc, const char* argv[]) {
+    long rounds = argc > 1 ? atol(argv[1]) : 1000000;
+
+    for (size_t i = 0; i < sizeof(_edges) / sizeof(_edges[0]); i += 1) {
+        _case_check(_edges[i]);
+    }
+    for (size_t i = 0; i < sizeof(_malformed) / sizeof(_malformed[0]); i += 1) {
+        _case_reject(_malformed[i]);
+    }
+
+    char chars[CASE_LENGTH_MAX];
+    for (long i = 0; i < rounds; i += 1) {
+        uint64_t bits = _random();
+        double num;
+        memcpy(&num, &bits, sizeof(num));
+        if (isnan(num) || isinf(num)) continue;
+
+        // Shortest and longest round trips, then every precision in between.
+        snprintf(chars, sizeof(chars), "%.17g", num);
+        _case_check(chars);
+        snprintf(chars, sizeof(chars), "%.*g", (int) (1 + _random() % 17), num);
+        _case_check(chars);
+
+        // Subnormals.
+        bits &= ~((uint64_t) 0x7ff << 52);
+        memcpy(&num, &bits, sizeof(num));
+        snprintf(chars, sizeof(chars), "%.*e", (int) (_random() % 20), num);
+        _case_check(chars);
+
+        // Integers up to 64 bits.
+        snprintf(chars, sizeof(chars), "%llu", (unsigned long long) (_random() >> (_random() % 64)));
+        _case_check(chars);
+
+        // Up to 19 random digits with any exponent, past both ends of the double's range.
+        char* end = chars;
+        if (_random() & 1) *end++ = '-';
+        int digits = 1 + (int) (_random() % 19);
+        int point  = (int) (_random() % (uint64_t) (digits + 1));
+        for (int d = 0; d < digits; d += 1) {
+            if (d == point && d > 0) *end++ = '.';
+            *end++ = (char) ('0' + _random() % 10);
+        }
+        snprintf(end, sizeof(chars) - (size_t) (end - chars), "e%d", (int) (_random() % 760) - 380);
+        _case_check(chars);
+
+        _midpoints_check(_random() >> 11 | (uint64_t) 1 << 52, 1 + (int) (_random() % 11));
+
+        bits = _random();
+        memcpy(&num, &bits, sizeof(num));
+        if (!isnan(num) && !isinf(num)) _near_midpoints_check(num);
+    }
+
+    printf("%ld cases, %ld failures\n", _case_count, _failure_count);
+    return _failure_count == 0 ? 0 : 1;
+}
+
+// xorshift64, the corpus is the same on every run.
+static uint64_t _random(void) {
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 7;
+    _seed ^= _seed << 17;
+    return _seed;
+}
+
+static void _case_check(const char* chars) {
+    double expected = strtod(chars, NULL);
+    double num      = 0;
+    bool   is_valid = number_parse(chars, (int) strlen(chars), &num);
+
+    _case_count += 1;
+    if (is_valid && memcmp(&num, &expected, sizeof(num)) == 0) return;
+
+    _failure_count += 1;
+    if (_failure_count <= FAILURES_SHOWN) {
+        printf("'%s': %.17g instead of %.17g%s\n", chars, num, expected, is_valid ? "" : " (rejected)");
+    }
+}
+
+static void _case_reject(const char* chars) {
+    double num;
+
+    _case_count += 1;
+    if (!number_parse(chars, (int) strlen(chars), &num)) return;
+
+    _failure_count += 1;
+    if (_failure_count <= FAILURES_SHOWN) printf("'%s': accepted as %.17g\n", chars, num);
+}
+
+// The doubles from 2^53 to 2^64 are mantissa * 2^shift, so the integers halfway between two of them are exact and
+// round to even. The integers on either side of them round to the nearest double.
+static void _midpoints_check(uint64_t mantissa, int shift) {
+    uint64_t midpoint = (mantissa << shift) + ((uint64_t) 1 << (shift - 1));
+
+    char chars[CASE_LENGTH_MAX];
+    for (int delta = -1; delta <= 1; delta += 1) {
+        snprintf(chars, sizeof(chars), "%llu", (unsigned long long) (midpoint + (uint64_t) (int64_t) delta));
+        _case_check(chars);
+    }
+}
+
+// Decimals next to the point halfway between num and the next double, written from a long double.
+static void _near_midpoints_check(double num) {
+    double next = nextafter(num, INFINITY);
+    if (isinf(next)) return;
+
+    char chars[CASE_LENGTH_MAX];
+    long double midpoint = ((long double) num + (long double) next) / 2;
+    snprintf(chars, sizeof(chars), "%.25Le", midpoint);
+    _case_check(chars);
+    snprintf(chars, sizeof(chars), "%.17Le", midpoint);
+    _case_check(chars);
+}
@@ -0,0 +1,70 @@
+// Checks how the scanner splits string literals around `${` and its `\${` escape.
+// Build and run from the repository root:
+//
+//     clang -O2 -Isrc tests/string_scan.c -o output/string_scan && ./output/string_scan
+//
+// Exits with 1 after printing the mismatches.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "scanner.c"
+
+#define CASE_TOKENS_MAX 8
+
+typedef struct Case {
+    const char*        source;
+    Scanner_Token_Type types[CASE_TOKENS_MAX];
+    const char*        lexemes[CASE_TOKENS_MAX];
+} Case;
+
+static long _case_count;
+static long _failure_count;
+
+static void _case_check(const Case* test);
+
+// Every case ends with TOKEN_EOF, its lexeme is left NULL.
+static const Case _cases[] = {
+    {"\"a\"",           {TOKEN_STRING, TOKEN_EOF}, {"\"a\""}},
+    {"\"\\${a}\"",      {TOKEN_STRING, TOKEN_EOF}, {"\"\\${a}\""}},
+    {"\"\\${\"",        {TOKEN_STRING, TOKEN_EOF}, {"\"\\${\""}},
+    {"\"\\$a\"",        {TOKEN_STRING, TOKEN_EOF}, {"\"\\$a\""}},
+    {"\"$a {\"",        {TOKEN_STRING, TOKEN_EOF}, {"\"$a {\""}},
+    {"\"${a}\"",        {TOKEN_INTERPOLATION, TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_EOF}, {"\"${", "a", "}\""}},
+    {"\"\\${a}${b}\"",  {TOKEN_INTERPOLATION, TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_EOF}, {"\"\\${a}${", "b", "}\""}},
+    {"\"${a}\\${b}\"",  {TOKEN_INTERPOLATION, TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_EOF}, {"\"${", "a", "}\\${b}\""}},
+    {"\"${\"\\${\"}\"", {TOKEN_INTERPOLATION, TOKEN_STRING, TOKEN_STRING, TOKEN_EOF}, {"\"${", "\"\\${\"", "}\""}},
+    {"\"\\",            {TOKEN_ERROR}, {NULL}},
+    {"\"\\${",          {TOKEN_ERROR}, {NULL}},
+};
+
+int main(void) {
+    for (size_t i = 0; i < sizeof(_cases) / sizeof(_cases[0]); i += 1) {
+        _case_check(&_cases[i]);
+    }
+
+    printf("%ld cases, %ld failures\n", _case_count, _failure_count);
+    return _failure_count == 0 ? 0 : 1;
+}
+
+static void _case_check(const Case* test) {
+    scanner_init(test->source);
+    _case_count += 1;
+
+    for (int i = 0; i < CASE_TOKENS_MAX; i += 1) {
+        Scanner_Token token  = scanner_scan_token();
+        const char*   lexeme = test->lexemes[i];
+
+        bool is_same = token.type == test->types[i];
+        if (is_same && lexeme != NULL) {
+            is_same = token.length == (int) strlen(lexeme) && memcmp(token.start, lexeme, token.length) == 0;
+        }
+        if (!is_same) {
+            _failure_count += 1;
+            printf("'%s': token %d is '%.*s' (%d)\n", test->source, i, token.length, token.start, token.type);
+            return;
+        }
+
+        if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) return;
+    }
+}